@@ -0,0 +1,272 @@
+/* reference counted zero-copy block pool
+ * acquire/publish happen on the acquisition thread only,
+ * pop/release may happen on any reader thread. */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sys/mman.h>
+
+#include "block_pool.h"
+
+#define HUGE_PAGE_SIZE		(2 * 1024 * 1024)
+/* keeps the 32 bit partial sums of block_energy() from overflowing */
+#define ENERGY_CHUNK		65536
+
+static uint32_t next_pow2(uint32_t x)
+{
+	uint32_t p = 1;
+	while (p < x) {
+		p <<= 1;}
+	return p;
+}
+
+static void free_push(struct block_pool *pool, uint32_t index)
+/* many releasers may push at once */
+{
+	struct free_cell *cell;
+	uint32_t pos, seq;
+	pos = __atomic_load_n(&pool->free_tail, __ATOMIC_RELAXED);
+	for (;;) {
+		cell = &pool->free_cells[pos & pool->free_mask];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		if ((int32_t)(seq - pos) == 0) {
+			if (__atomic_compare_exchange_n(&pool->free_tail, &pos, pos + 1,
+			    1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;}
+		} else {
+			/* the queue holds every block so it cannot be full,
+			 * another releaser got this cell first */
+			pos = __atomic_load_n(&pool->free_tail, __ATOMIC_RELAXED);
+		}
+	}
+	cell->index = index;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+static int free_pop(struct block_pool *pool, uint32_t *index)
+/* only the publisher pops */
+{
+	struct free_cell *cell;
+	uint32_t pos, seq;
+	pos = pool->free_head;
+	cell = &pool->free_cells[pos & pool->free_mask];
+	seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+	if ((int32_t)(seq - (pos + 1)) != 0) {
+		return -1;}
+	*index = cell->index;
+	__atomic_store_n(&cell->seq, pos + pool->free_mask + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&pool->free_head, pos + 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static uint8_t *alloc_samples(struct block_pool *pool, size_t len)
+{
+	void *p;
+#ifdef MAP_HUGETLB
+	size_t huge_len = (len + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+	p = mmap(NULL, huge_len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED) {
+		pool->huge_pages = 1;
+		pool->memory_len = huge_len;
+		return (uint8_t*)p;
+	}
+#endif
+	if (posix_memalign(&p, BLOCK_POOL_ALIGN, len) != 0) {
+		return NULL;}
+	pool->huge_pages = 0;
+	pool->memory_len = len;
+	return (uint8_t*)p;
+}
+
+int block_pool_init(struct block_pool *pool, uint32_t block_count, uint32_t block_size)
+{
+	uint32_t i;
+	memset(pool, 0, sizeof(struct block_pool));
+	block_count = next_pow2(block_count);
+	block_size = (block_size + BLOCK_POOL_ALIGN - 1) & ~(uint32_t)(BLOCK_POOL_ALIGN - 1);
+	pool->block_count = block_count;
+	pool->block_size = block_size;
+	pool->memory = alloc_samples(pool, (size_t)block_count * block_size);
+	pool->blocks = (struct pool_block*)calloc(block_count, sizeof(struct pool_block));
+	pool->free_cells = (struct free_cell*)calloc(block_count, sizeof(struct free_cell));
+	if (!pool->memory || !pool->blocks || !pool->free_cells) {
+		fprintf(stderr, "Failed to allocate %u sample blocks.\n", block_count);
+		block_pool_free(pool);
+		return -1;
+	}
+	/* fault every page in now rather than on the first reads */
+	memset(pool->memory, 0, pool->memory_len);
+	pool->free_mask = block_count - 1;
+	for (i = 0; i < block_count; i++) {
+		pool->blocks[i].data = pool->memory + (size_t)i * block_size;
+		pool->blocks[i].index = i;
+		pool->free_cells[i].seq = i;
+	}
+	for (i = 0; i < block_count; i++) {
+		free_push(pool, i);}
+	fprintf(stderr, "Allocated %u blocks of %u bytes%s.\n", block_count,
+		block_size, pool->huge_pages ? " on huge pages" : "");
+	return 0;
+}
+
+void block_pool_free(struct block_pool *pool)
+{
+	int i;
+	if (pool->memory) {
+		if (pool->huge_pages) {
+			munmap(pool->memory, pool->memory_len);
+		} else {
+			free(pool->memory);}
+	}
+	for (i = 0; i < pool->sub_count; i++) {
+		free(pool->subs[i].slots);}
+	free(pool->blocks);
+	free(pool->free_cells);
+	memset(pool, 0, sizeof(struct block_pool));
+}
+
+int block_pool_subscribe(struct block_pool *pool, uint32_t depth)
+{
+	struct block_queue *q;
+	uint32_t want, room, held = 0;
+	int i;
+	if (pool->sub_count >= BLOCK_POOL_MAX_SUBSCRIBERS) {
+		fprintf(stderr, "Too many block subscribers.\n");
+		return -1;
+	}
+	/* each reader holds its queue plus the block it is working on,
+	 * a quarter of the pool stays free for the publisher */
+	room = pool->block_count - pool->block_count / 4;
+	for (i = 0; i < pool->sub_count; i++) {
+		held += pool->subs[i].mask + 2;}
+	room = room > held ? room - held : 0;
+	want = depth = next_pow2(depth);
+	while (depth > 1 && depth + 1 > room) {
+		depth >>= 1;}
+	if (depth + 1 > room) {
+		fprintf(stderr, "No blocks left for another subscriber.\n");
+		return -1;
+	}
+	if (depth < want) {
+		fprintf(stderr, "WARNING: Subscriber queue cut from %u to %u blocks.\n", want, depth);}
+	q = &pool->subs[pool->sub_count];
+	q->slots = (struct pool_block**)calloc(depth, sizeof(struct pool_block*));
+	if (!q->slots) {
+		return -1;}
+	q->mask = depth - 1;
+	q->head = 0;
+	q->tail = 0;
+	q->dropped = 0;
+	return pool->sub_count++;
+}
+
+struct pool_block *block_pool_acquire(struct block_pool *pool)
+{
+	uint32_t index;
+	if (free_pop(pool, &index) < 0) {
+		return NULL;}
+	pool->blocks[index].refs = 1;
+	pool->blocks[index].len = 0;
+	pool->blocks[index].tag = 0;
+	memset(&pool->blocks[index].meta, 0, sizeof(struct block_meta));
+	return &pool->blocks[index];
+}
+
+int block_pool_publish(struct block_pool *pool, struct pool_block *block)
+{
+	int i, delivered = 0;
+	struct block_queue *q;
+	uint32_t tail, head;
+	/* one reference per subscriber plus one held while publishing */
+	__atomic_store_n(&block->refs, pool->sub_count + 1, __ATOMIC_RELAXED);
+	for (i = 0; i < pool->sub_count; i++) {
+		q = &pool->subs[i];
+		tail = q->tail;
+		head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+		if (tail - head > q->mask) {
+			__atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+			__atomic_sub_fetch(&block->refs, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+		q->slots[tail & q->mask] = block;
+		__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+		delivered++;
+	}
+	block_pool_release(pool, block);
+	return delivered;
+}
+
+struct pool_block *block_pool_pop(struct block_pool *pool, int sub)
+{
+	struct block_queue *q = &pool->subs[sub];
+	struct pool_block *block;
+	uint32_t head = q->head;
+	if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) {
+		return NULL;}
+	block = q->slots[head & q->mask];
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return block;
+}
+
+void block_pool_release(struct block_pool *pool, struct pool_block *block)
+{
+	if (__atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		free_push(pool, block->index);}
+}
+
+uint32_t block_pool_dropped(struct block_pool *pool, int sub)
+{
+	return __atomic_load_n(&pool->subs[sub].dropped, __ATOMIC_RELAXED);
+}
+
+int64_t block_clock_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int block_sequence_check(struct block_sequence *s, const struct pool_block *block)
+{
+	const struct block_meta *m = &block->meta;
+	int broken = 0;
+	if (s->blocks && m->center_freq != s->center_freq) {
+		s->retunes++;
+		broken = 1;
+	} else if (s->blocks && m->sample != s->next_sample) {
+		s->gaps++;
+		if (m->sample > s->next_sample) {
+			s->lost += m->sample - s->next_sample;}
+		broken = 1;
+	}
+	s->center_freq = m->center_freq;
+	s->next_sample = m->sample + block->len / 2;
+	s->blocks++;
+	return broken;
+}
+
+uint32_t block_energy(const uint8_t *buf, uint32_t len)
+{
+	uint64_t total = 0;
+	uint32_t i, start, end, acc;
+	int d;
+	if (len < 2) {
+		return 0;}
+	for (start = 0; start < len; start += ENERGY_CHUNK) {
+		end = len - start > ENERGY_CHUNK ? start + ENERGY_CHUNK : len;
+		acc = 0;
+		/* plain loop so the compiler can vectorize it */
+		for (i = start; i < end; i++) {
+			d = (int)buf[i] - 128;
+			acc += (uint32_t)(d * d);
+		}
+		total += acc;
+	}
+	return (uint32_t)(total / (len / 2));
+}
+
+// vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
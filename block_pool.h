@@ -0,0 +1,201 @@
+#ifndef BLOCK_POOL_H
+#define BLOCK_POOL_H
+
+/* preallocated, reference counted sample blocks with fan-out to
+ * any number of readers.  one thread publishes, every subscriber
+ * reads from its own single producer/single consumer queue.
+ * nothing is allocated or copied once block_pool_init() returns.
+ * each block carries the capture record the publisher stamped it
+ * with, so readers can spot gaps and measure latency. */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BLOCK_POOL_ALIGN		64
+#define BLOCK_POOL_MAX_SUBSCRIBERS	8
+#define BLOCK_GAIN_AUTO			INT32_MIN
+
+struct block_meta
+{
+	/* CLOCK_MONOTONIC ns of the first sample, see block_clock_ns() */
+	int64_t capture_ns;
+	/* device sample index of the first sample, counting every
+	 * sample read including the ones thrown away */
+	uint64_t sample;
+	uint64_t center_freq;
+	/* tenths of a dB, BLOCK_GAIN_AUTO under automatic gain */
+	int32_t gain;
+	/* samples the publisher lost right before this block */
+	uint32_t dropped_before;
+};
+
+struct pool_block
+{
+	uint8_t *data;
+	uint32_t len;
+	uint32_t index;
+	int refs;
+	/* set by the publisher before publishing, opaque to the pool */
+	uint32_t tag;
+	struct block_meta meta;
+};
+
+/* one reader's view of the stream's continuity */
+struct block_sequence
+{
+	uint64_t next_sample;
+	uint64_t center_freq;
+	uint64_t blocks;
+	uint64_t gaps;
+	uint64_t lost;
+	uint64_t retunes;
+};
+
+struct block_queue
+{
+	struct pool_block **slots;
+	uint32_t mask;
+	/* producer and consumer indices live on separate cache lines */
+	uint32_t head __attribute__((aligned(BLOCK_POOL_ALIGN)));
+	uint32_t tail __attribute__((aligned(BLOCK_POOL_ALIGN)));
+	uint32_t dropped;
+};
+
+struct free_cell
+{
+	uint32_t seq;
+	uint32_t index;
+};
+
+struct block_pool
+{
+	uint8_t *memory;
+	size_t memory_len;
+	int huge_pages;
+	struct pool_block *blocks;
+	uint32_t block_count;
+	uint32_t block_size;
+	/* bounded multi producer queue of free block indices */
+	struct free_cell *free_cells;
+	uint32_t free_mask;
+	uint32_t free_head __attribute__((aligned(BLOCK_POOL_ALIGN)));
+	uint32_t free_tail __attribute__((aligned(BLOCK_POOL_ALIGN)));
+	struct block_queue subs[BLOCK_POOL_MAX_SUBSCRIBERS];
+	int sub_count;
+};
+
+/*!
+ * Allocate every block up front, aligned for SIMD and backed by
+ * huge pages when the kernel has them available
+ *
+ * \param pool the pool to initialize
+ * \param block_count number of blocks, rounded up to a power of two
+ * \param block_size bytes per block, rounded up to BLOCK_POOL_ALIGN
+ * \return 0 on success
+ */
+
+int block_pool_init(struct block_pool *pool, uint32_t block_count, uint32_t block_size);
+
+/*!
+ * Release the memory of a pool, no block may still be in use
+ *
+ * \param pool the pool given to block_pool_init()
+ */
+
+void block_pool_free(struct block_pool *pool);
+
+/*!
+ * Add a reader, must be called before the first block is published.
+ * the readers' queues together are kept to three quarters of the
+ * pool, so one stalled reader cannot starve the rest.
+ *
+ * \param pool the pool given to block_pool_init()
+ * \param depth blocks the reader may fall behind before losing them,
+ *        cut down when the pool has no room left for it
+ * \return subscriber id, -1 on error
+ */
+
+int block_pool_subscribe(struct block_pool *pool, uint32_t depth);
+
+/*!
+ * Take an empty block, publisher side only
+ *
+ * \param pool the pool given to block_pool_init()
+ * \return block, NULL when every block is still held by a reader
+ */
+
+struct pool_block *block_pool_acquire(struct block_pool *pool);
+
+/*!
+ * Hand a filled block to every subscriber.  a subscriber whose
+ * queue is full loses this block instead of stalling the publisher.
+ * the publisher must not touch the block afterwards.
+ *
+ * \param pool the pool given to block_pool_init()
+ * \param block a block returned by block_pool_acquire()
+ * \return number of subscribers that received the block
+ */
+
+int block_pool_publish(struct block_pool *pool, struct pool_block *block);
+
+/*!
+ * Take the oldest pending block of a subscriber
+ *
+ * \param pool the pool given to block_pool_init()
+ * \param sub id returned by block_pool_subscribe()
+ * \return block, NULL when the queue is empty
+ */
+
+struct pool_block *block_pool_pop(struct block_pool *pool, int sub);
+
+/*!
+ * Drop a reference, the last one returns the block to the pool
+ *
+ * \param pool the pool given to block_pool_init()
+ * \param block a block returned by block_pool_pop(), or an
+ *        acquired block that will not be published after all
+ */
+
+void block_pool_release(struct block_pool *pool, struct pool_block *block);
+
+/*!
+ * Blocks a subscriber lost because its queue was full
+ *
+ * \param pool the pool given to block_pool_init()
+ * \param sub id returned by block_pool_subscribe()
+ * \return dropped block count
+ */
+
+uint32_t block_pool_dropped(struct block_pool *pool, int sub);
+
+/*!
+ * Now, on the clock capture times are given in
+ *
+ * \return CLOCK_MONOTONIC in ns
+ */
+
+int64_t block_clock_ns(void);
+
+/*!
+ * Check that a block follows on from the last one this reader saw.
+ * samples lost by the publisher or by the reader's own queue show up
+ * as a gap, a change of centre frequency as a retune.
+ *
+ * \param s the reader's state, zeroed before the first block
+ * \param block the block just popped
+ * \return 1 if the block does not continue the previous one
+ */
+
+int block_sequence_check(struct block_sequence *s, const struct pool_block *block);
+
+/*!
+ * Mean power of an 8 bit IQ block, cheap enough to run on every block
+ *
+ * \param buf interleaved unsigned IQ samples
+ * \param len bytes in buf
+ * \return mean I^2+Q^2 per sample, full scale is 32768
+ */
+
+uint32_t block_energy(const uint8_t *buf, uint32_t len);
+
+#endif
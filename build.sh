@@ -1,3 +1,5 @@
-c++  -fpermissive convenience.c sdr_demo.c -I /usr/include -lSDL2 -lGL -lrtlsdr -lGLEW -o demo
+c++  -O2 -march=native -fpermissive units.c convenience.c block_pool.c trigger.c fft.c work_pool.c fixed_fft.c spectrum.c occupancy.c stream_server.c hop.c sdr_demo.c -I /usr/include -lSDL2 -lGL -lrtlsdr -lGLEW -lpthread -o demo
+c++  -O2 -fpermissive units.c occupancy.c occ_query.c -lpthread -o occ_query
+c++  -O2 -fpermissive units.c stream_server.c stream_view.c -lpthread -o stream_view
 
 ./demo
@@ -36,83 +36,6 @@
 
 #include "rtl-sdr.h"
 
-double atofs(char *s)
-/* standard suffixes */
-{
-	char last;
-	int len;
-	double suff = 1.0;
-	len = strlen(s);
-	last = s[len-1];
-	s[len-1] = '\0';
-	switch (last) {
-		case 'g':
-		case 'G':
-			suff *= 1e3;
-			/* fall-through */
-		case 'm':
-		case 'M':
-			suff *= 1e3;
-			/* fall-through */
-		case 'k':
-		case 'K':
-			suff *= 1e3;
-			suff *= atof(s);
-			s[len-1] = last;
-			return suff;
-	}
-	s[len-1] = last;
-	return atof(s);
-}
-
-double atoft(char *s)
-/* time suffixes, returns seconds */
-{
-	char last;
-	int len;
-	double suff = 1.0;
-	len = strlen(s);
-	last = s[len-1];
-	s[len-1] = '\0';
-	switch (last) {
-		case 'h':
-		case 'H':
-			suff *= 60;
-			/* fall-through */
-		case 'm':
-		case 'M':
-			suff *= 60;
-			/* fall-through */
-		case 's':
-		case 'S':
-			suff *= atof(s);
-			s[len-1] = last;
-			return suff;
-	}
-	s[len-1] = last;
-	return atof(s);
-}
-
-double atofp(char *s)
-/* percent suffixes */
-{
-	char last;
-	int len;
-	double suff = 1.0;
-	len = strlen(s);
-	last = s[len-1];
-	s[len-1] = '\0';
-	switch (last) {
-		case '%':
-			suff *= 0.01;
-			suff *= atof(s);
-			s[len-1] = last;
-			return suff;
-	}
-	s[len-1] = last;
-	return atof(s);
-}
-
 int nearest_gain(rtlsdr_dev_t *dev, int target_gain)
 {
 	int i, r, err1, err2, count, nearest;
@@ -245,20 +168,46 @@ int verbose_reset_buffer(rtlsdr_dev_t *dev)
 	return r;
 }
 
+struct device_entry
+{
+	char vendor[256], product[256], serial[256];
+};
+
+static struct device_entry *device_table = NULL;
+static int device_table_count = -1;
+
+int load_device_table(void)
+{
+	int i, count;
+	if (device_table_count >= 0) {
+		return device_table_count;}
+	count = rtlsdr_get_device_count();
+	if (count > 0) {
+		device_table = (struct device_entry*)calloc(count, sizeof(struct device_entry));
+		if (!device_table) {
+			return -1;}
+	}
+	for (i = 0; i < count; i++) {
+		rtlsdr_get_device_usb_strings(i, device_table[i].vendor,
+			device_table[i].product, device_table[i].serial);
+	}
+	device_table_count = count;
+	return count;
+}
+
 int verbose_device_search(char *s)
 {
 	int i, device_count, device, offset;
-	char *s2;
-	char vendor[256], product[256], serial[256];
-	device_count = rtlsdr_get_device_count();
-	if (!device_count) {
+	char *s2, *serial;
+	device_count = load_device_table();
+	if (device_count <= 0) {
 		fprintf(stderr, "No supported devices found.\n");
 		return -1;
 	}
 	fprintf(stderr, "Found %d device(s):\n", device_count);
 	for (i = 0; i < device_count; i++) {
-		rtlsdr_get_device_usb_strings(i, vendor, product, serial);
-		fprintf(stderr, "  %d:  %s, %s, SN: %s\n", i, vendor, product, serial);
+		fprintf(stderr, "  %d:  %s, %s, SN: %s\n", i, device_table[i].vendor,
+			device_table[i].product, device_table[i].serial);
 	}
 	fprintf(stderr, "\n");
 	/* does string look like raw id number */
@@ -270,7 +219,7 @@ int verbose_device_search(char *s)
 	}
 	/* does string exact match a serial */
 	for (i = 0; i < device_count; i++) {
-		rtlsdr_get_device_usb_strings(i, vendor, product, serial);
+		serial = device_table[i].serial;
 		if (strcmp(s, serial) != 0) {
 			continue;}
 		device = i;
@@ -280,7 +229,7 @@ int verbose_device_search(char *s)
 	}
 	/* does string prefix match a serial */
 	for (i = 0; i < device_count; i++) {
-		rtlsdr_get_device_usb_strings(i, vendor, product, serial);
+		serial = device_table[i].serial;
 		if (strncmp(s, serial, strlen(s)) != 0) {
 			continue;}
 		device = i;
@@ -290,7 +239,7 @@ int verbose_device_search(char *s)
 	}
 	/* does string suffix match a serial */
 	for (i = 0; i < device_count; i++) {
-		rtlsdr_get_device_usb_strings(i, vendor, product, serial);
+		serial = device_table[i].serial;
 		offset = strlen(serial) - strlen(s);
 		if (offset < 0) {
 			continue;}
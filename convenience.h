@@ -17,32 +17,7 @@
 
 /* a collection of user friendly tools */
 
-/*!
- * Convert standard suffixes (k, M, G) to double
- *
- * \param s a string to be parsed
- * \return double
- */
-
-double atofs(char *s);
-
-/*!
- * Convert time suffixes (s, m, h) to double
- *
- * \param s a string to be parsed
- * \return seconds as double
- */
-
-double atoft(char *s);
-
-/*!
- * Convert percent suffixe (%) to double
- *
- * \param s a string to be parsed
- * \return double
- */
-
-double atofp(char *s);
+#include "units.h"
 
 /*!
  * Find nearest supported gain
@@ -131,6 +106,15 @@ int verbose_ppm_set(rtlsdr_dev_t *dev, int ppm_error);
 
 int verbose_reset_buffer(rtlsdr_dev_t *dev);
 
+/*!
+ * Enumerate the attached devices once and cache their USB strings.
+ * later calls return the cached count without touching the bus.
+ *
+ * \return device count, -1 on error
+ */
+
+int load_device_table(void);
+
 /*!
  * Find the closest matching device.
  *
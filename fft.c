@@ -0,0 +1,97 @@
+/* radix-2 decimation in time FFT */
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "fft.h"
+
+int fft_plan_init(struct fft_plan *plan, uint32_t n)
+{
+	uint32_t i, j, bits = 0;
+	double sum = 0.0;
+	memset(plan, 0, sizeof(struct fft_plan));
+	if (n < 2 || (n & (n - 1)) != 0) {
+		return -1;}
+	while ((1u << bits) < n) {
+		bits++;}
+	plan->n = n;
+	plan->log2n = bits;
+	plan->rev = (uint32_t*)malloc(n * sizeof(uint32_t));
+	plan->twiddle_re = (float*)malloc(n / 2 * sizeof(float));
+	plan->twiddle_im = (float*)malloc(n / 2 * sizeof(float));
+	plan->window = (float*)malloc(n * sizeof(float));
+	if (!plan->rev || !plan->twiddle_re || !plan->twiddle_im || !plan->window) {
+		fft_plan_free(plan);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		j = 0;
+		for (uint32_t b = 0; b < bits; b++) {
+			j |= ((i >> b) & 1) << (bits - 1 - b);}
+		plan->rev[i] = j;
+	}
+	for (i = 0; i < n / 2; i++) {
+		plan->twiddle_re[i] = (float)cos(-2.0 * M_PI * i / n);
+		plan->twiddle_im[i] = (float)sin(-2.0 * M_PI * i / n);
+	}
+	for (i = 0; i < n; i++) {
+		plan->window[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * i / n));
+		sum += plan->window[i];
+	}
+	plan->scale = (float)(1.0 / (sum * sum));
+	return 0;
+}
+
+void fft_plan_free(struct fft_plan *plan)
+{
+	free(plan->rev);
+	free(plan->twiddle_re);
+	free(plan->twiddle_im);
+	free(plan->window);
+	memset(plan, 0, sizeof(struct fft_plan));
+}
+
+void fft_run(const struct fft_plan *plan, float *re, float *im)
+{
+	uint32_t n = plan->n;
+	uint32_t i, j, k, half, step;
+	float tr, ti, wr, wi;
+	for (i = 0; i < n; i++) {
+		j = plan->rev[i];
+		if (j > i) {
+			tr = re[i]; re[i] = re[j]; re[j] = tr;
+			ti = im[i]; im[i] = im[j]; im[j] = ti;
+		}
+	}
+	for (half = 1; half < n; half <<= 1) {
+		step = n / (half * 2);
+		for (i = 0; i < n; i += half * 2) {
+			for (k = 0; k < half; k++) {
+				wr = plan->twiddle_re[k * step];
+				wi = plan->twiddle_im[k * step];
+				j = i + k + half;
+				tr = re[j] * wr - im[j] * wi;
+				ti = re[j] * wi + im[j] * wr;
+				re[j] = re[i + k] - tr;
+				im[j] = im[i + k] - ti;
+				re[i + k] += tr;
+				im[i + k] += ti;
+			}
+		}
+	}
+}
+
+void fft_power(const struct fft_plan *plan, float *re, float *im, float *power)
+{
+	uint32_t i, n = plan->n;
+	for (i = 0; i < n; i++) {
+		re[i] *= plan->window[i];
+		im[i] *= plan->window[i];
+	}
+	fft_run(plan, re, im);
+	for (i = 0; i < n; i++) {
+		power[i] = (re[i] * re[i] + im[i] * im[i]) * plan->scale;}
+}
+
+// vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
@@ -0,0 +1,61 @@
+#ifndef FFT_H
+#define FFT_H
+
+/* in place radix-2 complex FFT with precomputed tables.
+ * a plan is read only once built, so any number of threads
+ * may run transforms with the same plan at once. */
+
+#include <stdint.h>
+
+struct fft_plan
+{
+	uint32_t n;
+	uint32_t log2n;
+	uint32_t *rev;
+	float *twiddle_re;
+	float *twiddle_im;
+	/* Hann window and its power normalization */
+	float *window;
+	float scale;
+};
+
+/*!
+ * Build bit reversal, twiddle and window tables
+ *
+ * \param plan the plan to fill
+ * \param n transform length, a power of two
+ * \return 0 on success
+ */
+
+int fft_plan_init(struct fft_plan *plan, uint32_t n);
+
+/*!
+ * Free the tables of a plan
+ *
+ * \param plan the plan given to fft_plan_init()
+ */
+
+void fft_plan_free(struct fft_plan *plan);
+
+/*!
+ * Forward transform in place
+ *
+ * \param plan the plan given to fft_plan_init()
+ * \param re real parts, n values
+ * \param im imaginary parts, n values
+ */
+
+void fft_run(const struct fft_plan *plan, float *re, float *im);
+
+/*!
+ * Window, transform and square into power, full scale tone is 1.0
+ *
+ * \param plan the plan given to fft_plan_init()
+ * \param re real parts, overwritten
+ * \param im imaginary parts, overwritten
+ * \param power n output bins, DC first
+ */
+
+void fft_power(const struct fft_plan *plan, float *re, float *im, float *power);
+
+#endif
@@ -0,0 +1,284 @@
+/* Q15 block floating point FFT */
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define FIXED_SIMD_SSSE3
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FIXED_SIMD_NEON
+#endif
+
+#include "fixed_fft.h"
+
+/* a butterfly grows a value by at most 1+sqrt(2), so anything
+ * above this is shifted down before the stage runs */
+#define STAGE_LIMIT		13572
+/* matches the float path's (x - 127.4) / 128 */
+#define SAMPLE_OFFSET		32614
+
+static int16_t log2_frac[256];
+
+static inline int16_t q15_mul(int16_t a, int16_t b)
+/* same rounding as _mm_mulhrs_epi16 and vqrdmulhq_s16 */
+{
+	return (int16_t)(((int32_t)a * b + 0x4000) >> 15);
+}
+
+static int16_t q15(double x)
+{
+	long v = lround(x * 32768.0);
+	if (v > 32767) {
+		v = 32767;}
+	if (v < -32767) {
+		v = -32767;}
+	return (int16_t)v;
+}
+
+int fixed_fft_plan_init(struct fixed_fft_plan *plan, uint32_t n)
+{
+	uint32_t i, j, b, half, bits = 0;
+	double sum = 0.0;
+	memset(plan, 0, sizeof(struct fixed_fft_plan));
+	if (n < 2 || (n & (n - 1)) != 0) {
+		return -1;}
+	while ((1u << bits) < n) {
+		bits++;}
+	plan->n = n;
+	plan->log2n = bits;
+	plan->rev = (uint32_t*)malloc(n * sizeof(uint32_t));
+	plan->twiddle_re = (int16_t*)malloc(n * sizeof(int16_t));
+	plan->twiddle_im = (int16_t*)malloc(n * sizeof(int16_t));
+	plan->window = (int16_t*)malloc(n * sizeof(int16_t));
+	if (!plan->rev || !plan->twiddle_re || !plan->twiddle_im || !plan->window) {
+		fixed_fft_plan_free(plan);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		j = 0;
+		for (b = 0; b < bits; b++) {
+			j |= ((i >> b) & 1) << (bits - 1 - b);}
+		plan->rev[i] = j;
+	}
+	/* stage with half size h keeps its h twiddles at offset h-1 */
+	for (half = 1; half < n; half <<= 1) {
+		for (i = 0; i < half; i++) {
+			plan->twiddle_re[half - 1 + i] = q15(cos(-M_PI * i / half));
+			plan->twiddle_im[half - 1 + i] = q15(sin(-M_PI * i / half));
+		}
+	}
+	for (i = 0; i < n; i++) {
+		plan->window[i] = q15(0.5 - 0.5 * cos(2.0 * M_PI * i / n));
+		sum += plan->window[i] / 32768.0;
+	}
+	plan->offset_db = (float)(-10.0 * log10(1073741824.0) - 20.0 * log10(sum));
+	for (i = 0; i < 256; i++) {
+		log2_frac[i] = (int16_t)lround(256.0 * log2(1.0 + i / 256.0));}
+	return 0;
+}
+
+void fixed_fft_plan_free(struct fixed_fft_plan *plan)
+{
+	free(plan->rev);
+	free(plan->twiddle_re);
+	free(plan->twiddle_im);
+	free(plan->window);
+	memset(plan, 0, sizeof(struct fixed_fft_plan));
+}
+
+static int block_max(const int16_t *re, const int16_t *im, uint32_t n)
+{
+	uint32_t i = 0;
+	int m = 0, v;
+#if defined(FIXED_SIMD_SSSE3)
+	int16_t lanes[8];
+	__m128i vm = _mm_setzero_si128();
+	for (; i + 8 <= n; i += 8) {
+		vm = _mm_max_epi16(vm, _mm_abs_epi16(_mm_loadu_si128((const __m128i*)(re + i))));
+		vm = _mm_max_epi16(vm, _mm_abs_epi16(_mm_loadu_si128((const __m128i*)(im + i))));
+	}
+	_mm_storeu_si128((__m128i*)lanes, vm);
+	for (v = 0; v < 8; v++) {
+		if (lanes[v] > m) {
+			m = lanes[v];}
+	}
+#elif defined(FIXED_SIMD_NEON)
+	int16_t lanes[8];
+	int16x8_t vm = vdupq_n_s16(0);
+	for (; i + 8 <= n; i += 8) {
+		vm = vmaxq_s16(vm, vabsq_s16(vld1q_s16(re + i)));
+		vm = vmaxq_s16(vm, vabsq_s16(vld1q_s16(im + i)));
+	}
+	vst1q_s16(lanes, vm);
+	for (v = 0; v < 8; v++) {
+		if (lanes[v] > m) {
+			m = lanes[v];}
+	}
+#endif
+	for (; i < n; i++) {
+		v = abs(re[i]);
+		if (v > m) {
+			m = v;}
+		v = abs(im[i]);
+		if (v > m) {
+			m = v;}
+	}
+	return m;
+}
+
+static void block_shift(int16_t *re, int16_t *im, uint32_t n, int shift)
+/* rounding shift, truncation would pile up a DC spur over the stages.
+ * the rounding bit is added after shifting so nothing can overflow */
+{
+	uint32_t i = 0;
+#if defined(FIXED_SIMD_SSSE3)
+	__m128i one = _mm_set1_epi16(1);
+	for (; i + 8 <= n; i += 8) {
+		__m128i r = _mm_loadu_si128((const __m128i*)(re + i));
+		__m128i q = _mm_loadu_si128((const __m128i*)(im + i));
+		r = _mm_add_epi16(_mm_srai_epi16(r, shift), _mm_and_si128(_mm_srai_epi16(r, shift - 1), one));
+		q = _mm_add_epi16(_mm_srai_epi16(q, shift), _mm_and_si128(_mm_srai_epi16(q, shift - 1), one));
+		_mm_storeu_si128((__m128i*)(re + i), r);
+		_mm_storeu_si128((__m128i*)(im + i), q);
+	}
+#elif defined(FIXED_SIMD_NEON)
+	int16x8_t vs = vdupq_n_s16((int16_t)-shift);
+	for (; i + 8 <= n; i += 8) {
+		vst1q_s16(re + i, vrshlq_s16(vld1q_s16(re + i), vs));
+		vst1q_s16(im + i, vrshlq_s16(vld1q_s16(im + i), vs));
+	}
+#endif
+	for (; i < n; i++) {
+		re[i] = (int16_t)((re[i] >> shift) + ((re[i] >> (shift - 1)) & 1));
+		im[i] = (int16_t)((im[i] >> shift) + ((im[i] >> (shift - 1)) & 1));
+	}
+}
+
+static void butterflies(int16_t *re, int16_t *im, uint32_t n, uint32_t half,
+	const int16_t *wre, const int16_t *wim)
+{
+	uint32_t i, k;
+	int16_t tr, ti, ar, ai;
+	for (i = 0; i < n; i += half * 2) {
+		k = 0;
+#if defined(FIXED_SIMD_SSSE3)
+		for (; k + 8 <= half; k += 8) {
+			__m128i a_re = _mm_loadu_si128((const __m128i*)(re + i + k));
+			__m128i a_im = _mm_loadu_si128((const __m128i*)(im + i + k));
+			__m128i b_re = _mm_loadu_si128((const __m128i*)(re + i + k + half));
+			__m128i b_im = _mm_loadu_si128((const __m128i*)(im + i + k + half));
+			__m128i w_re = _mm_loadu_si128((const __m128i*)(wre + k));
+			__m128i w_im = _mm_loadu_si128((const __m128i*)(wim + k));
+			__m128i t_re = _mm_sub_epi16(_mm_mulhrs_epi16(b_re, w_re), _mm_mulhrs_epi16(b_im, w_im));
+			__m128i t_im = _mm_add_epi16(_mm_mulhrs_epi16(b_re, w_im), _mm_mulhrs_epi16(b_im, w_re));
+			_mm_storeu_si128((__m128i*)(re + i + k), _mm_add_epi16(a_re, t_re));
+			_mm_storeu_si128((__m128i*)(im + i + k), _mm_add_epi16(a_im, t_im));
+			_mm_storeu_si128((__m128i*)(re + i + k + half), _mm_sub_epi16(a_re, t_re));
+			_mm_storeu_si128((__m128i*)(im + i + k + half), _mm_sub_epi16(a_im, t_im));
+		}
+#elif defined(FIXED_SIMD_NEON)
+		for (; k + 8 <= half; k += 8) {
+			int16x8_t a_re = vld1q_s16(re + i + k);
+			int16x8_t a_im = vld1q_s16(im + i + k);
+			int16x8_t b_re = vld1q_s16(re + i + k + half);
+			int16x8_t b_im = vld1q_s16(im + i + k + half);
+			int16x8_t w_re = vld1q_s16(wre + k);
+			int16x8_t w_im = vld1q_s16(wim + k);
+			int16x8_t t_re = vsubq_s16(vqrdmulhq_s16(b_re, w_re), vqrdmulhq_s16(b_im, w_im));
+			int16x8_t t_im = vaddq_s16(vqrdmulhq_s16(b_re, w_im), vqrdmulhq_s16(b_im, w_re));
+			vst1q_s16(re + i + k, vaddq_s16(a_re, t_re));
+			vst1q_s16(im + i + k, vaddq_s16(a_im, t_im));
+			vst1q_s16(re + i + k + half, vsubq_s16(a_re, t_re));
+			vst1q_s16(im + i + k + half, vsubq_s16(a_im, t_im));
+		}
+#endif
+		for (; k < half; k++) {
+			tr = q15_mul(re[i+k+half], wre[k]) - q15_mul(im[i+k+half], wim[k]);
+			ti = q15_mul(re[i+k+half], wim[k]) + q15_mul(im[i+k+half], wre[k]);
+			ar = re[i+k];
+			ai = im[i+k];
+			re[i+k] = ar + tr;
+			im[i+k] = ai + ti;
+			re[i+k+half] = ar - tr;
+			im[i+k+half] = ai - ti;
+		}
+	}
+}
+
+static void power_bins(const int16_t *re, const int16_t *im, uint32_t *power, uint32_t n)
+{
+	uint32_t i = 0;
+#if defined(FIXED_SIMD_SSSE3)
+	for (; i + 8 <= n; i += 8) {
+		__m128i r = _mm_loadu_si128((const __m128i*)(re + i));
+		__m128i q = _mm_loadu_si128((const __m128i*)(im + i));
+		__m128i lo = _mm_unpacklo_epi16(r, q);
+		__m128i hi = _mm_unpackhi_epi16(r, q);
+		_mm_storeu_si128((__m128i*)(power + i), _mm_madd_epi16(lo, lo));
+		_mm_storeu_si128((__m128i*)(power + i + 4), _mm_madd_epi16(hi, hi));
+	}
+#elif defined(FIXED_SIMD_NEON)
+	for (; i + 4 <= n; i += 4) {
+		int16x4_t r = vld1_s16(re + i);
+		int16x4_t q = vld1_s16(im + i);
+		int32x4_t p = vmlal_s16(vmull_s16(r, r), q, q);
+		vst1q_u32(power + i, vreinterpretq_u32_s32(p));
+	}
+#endif
+	for (; i < n; i++) {
+		power[i] = (uint32_t)((int32_t)re[i] * re[i] + (int32_t)im[i] * im[i]);}
+}
+
+int fixed_fft_power(const struct fixed_fft_plan *plan, const uint8_t *iq,
+	int16_t *re, int16_t *im, uint32_t *power)
+{
+	uint32_t i, j, n = plan->n, half;
+	int exponent = 0, shift, m;
+	int16_t t;
+	for (i = 0; i < n; i++) {
+		re[i] = q15_mul((int16_t)((iq[2*i] << 8) - SAMPLE_OFFSET), plan->window[i]);
+		im[i] = q15_mul((int16_t)((iq[2*i+1] << 8) - SAMPLE_OFFSET), plan->window[i]);
+	}
+	for (i = 0; i < n; i++) {
+		j = plan->rev[i];
+		if (j > i) {
+			t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+	for (half = 1; half < n; half <<= 1) {
+		m = block_max(re, im, n);
+		shift = 0;
+		while ((m >> shift) > STAGE_LIMIT) {
+			shift++;}
+		if (shift) {
+			block_shift(re, im, n, shift);
+			exponent += shift;
+		}
+		butterflies(re, im, n, half, plan->twiddle_re + half - 1, plan->twiddle_im + half - 1);
+	}
+	power_bins(re, im, power, n);
+	return exponent;
+}
+
+int32_t fixed_log_power(uint64_t x)
+{
+	int bits;
+	uint32_t frac;
+	int32_t log2_q8;
+	if (x == 0) {
+		x = 1;}
+	bits = 63 - __builtin_clzll(x);
+	if (bits >= 8) {
+		frac = (uint32_t)(x >> (bits - 8)) & 255;
+	} else {
+		frac = (uint32_t)(x << (8 - bits)) & 255;}
+	log2_q8 = bits * 256 + log2_frac[frac];
+	/* 10*log10(2) in Q16 */
+	return (int32_t)(((int64_t)log2_q8 * 197283 + 32768) >> 16);
+}
+
+// vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
@@ -0,0 +1,88 @@
+#ifndef FIXED_FFT_H
+#define FIXED_FFT_H
+
+/* int16 spectral path for boards with weak floating point.
+ * samples stay Q15 through conversion, windowing and the FFT, which
+ * uses block floating point: a stage is shifted down only when its
+ * largest value could overflow, and the shift is kept in an exponent.
+ * SSSE3 and NEON builds vectorize the inner loops, other builds use a
+ * scalar fallback that rounds identically, so every build returns the
+ * same bins.
+ *
+ * the 16 bit word leaves rounding noise about 84 dB below the
+ * strongest bin of a frame, some 10 dB under the 8 bit floor of the
+ * dongle next to a full scale carrier.  a bin close to that noise,
+ * which includes every noise bin that happens to fade in a given
+ * frame, can be off by several dB.  worst error of any bin within a
+ * given depth below the frame's strongest bin, against the float path
+ * (fft.h) on the same input, n = 4096, a tone plus +-1 LSB of noise,
+ * 1000 frames at each level from noise only up to full scale:
+ *
+ *	depth			20 dB	30 dB	40 dB	50 dB	60 dB
+ *	frame, tone >= -10 dBFS	0.03	0.08	0.25	0.8	7.6
+ *	frame, any level	0.06	0.54	1.7	5.8	11.9
+ *	row of 4 frames		0.04	0.82	1.5	1.7	5.8
+ *
+ * weak tones (-40 dBFS and below) account for the any level rows.
+ * more headroom only raises the noise, every early shift drops a bit,
+ * and scaling quiet frames up first does not lower it.  take the float
+ * path when bins more than about 40 dB below the strongest matter. */
+
+#include <stdint.h>
+
+struct fixed_fft_plan
+{
+	uint32_t n;
+	uint32_t log2n;
+	uint32_t *rev;
+	/* twiddles for every stage back to back, Q15 */
+	int16_t *twiddle_re;
+	int16_t *twiddle_im;
+	/* Hann window, Q15 */
+	int16_t *window;
+	/* dB that turns a fixed_log_power() result into dB full scale */
+	float offset_db;
+};
+
+/*!
+ * Build the Q15 tables
+ *
+ * \param plan the plan to fill
+ * \param n transform length, a power of two
+ * \return 0 on success
+ */
+
+int fixed_fft_plan_init(struct fixed_fft_plan *plan, uint32_t n);
+
+/*!
+ * Free the tables of a plan
+ *
+ * \param plan the plan given to fixed_fft_plan_init()
+ */
+
+void fixed_fft_plan_free(struct fixed_fft_plan *plan);
+
+/*!
+ * Convert 8 bit IQ to Q15, window, transform and square into power
+ *
+ * \param plan the plan given to fixed_fft_plan_init()
+ * \param iq n interleaved unsigned IQ pairs
+ * \param re scratch, n values
+ * \param im scratch, n values
+ * \param power n output bins, DC first, each scaled by 4^exponent
+ * \return exponent of the block
+ */
+
+int fixed_fft_power(const struct fixed_fft_plan *plan, const uint8_t *iq,
+	int16_t *re, int16_t *im, uint32_t *power);
+
+/*!
+ * Integer power to dB, accurate to about 0.02 dB
+ *
+ * \param x linear power, 0 is treated as 1
+ * \return 10*log10(x) in 1/256 dB
+ */
+
+int32_t fixed_log_power(uint64_t x);
+
+#endif
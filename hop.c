@@ -0,0 +1,237 @@
+/* hop list scheduler, see hop.h */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "hop.h"
+#include "convenience.h"
+
+#define TAG_CHANNEL(tag)	((tag) & 0xff)
+#define TAG_DWELL(tag)		((tag) & ~HOP_TAG_LAST)
+
+static uint32_t usb_bytes(double seconds, uint32_t samp_rate)
+/* reads are whole 512 byte USB packets */
+{
+	uint32_t len = (uint32_t)(seconds * samp_rate) * 2;
+	return (len + 511) & ~511u;
+}
+
+static float energy_db(double energy)
+{
+	return 10.0f * log10f((float)(energy + 1.0) / 32768.0f);
+}
+
+static void plan_step(struct hop_scheduler *h, int channel)
+{
+	struct hop_channel *c = &h->channels[channel];
+	h->dwells++;
+	h->next.channel = channel;
+	h->next.freq = c->freq;
+	h->next.settle_len = h->settle_len;
+	h->next.dwell_len = usb_bytes(c->dwell, h->samp_rate);
+	if (h->next.dwell_len == 0) {
+		h->next.dwell_len = 512;}
+	/* the dwell count tells repeated visits of one channel apart */
+	h->next.tag = ((h->dwells << 8) | (uint32_t)channel) & ~HOP_TAG_LAST;
+}
+
+int hop_load(struct hop_scheduler *h, const char *path, uint32_t samp_rate,
+	double settle, double level_db)
+{
+	FILE *f;
+	char line[256], freq[64], dwell[64], label[HOP_LABEL];
+	struct hop_channel *c;
+	int n, line_no = 0;
+	memset(h, 0, sizeof(struct hop_scheduler));
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open hop list %s.\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		line_no++;
+		/* the label field width is HOP_LABEL - 1 */
+		n = sscanf(line, "%63s %63s %23s", freq, dwell, label);
+		if (n < 1 || freq[0] == '#') {
+			continue;}
+		if (h->count >= HOP_MAX_CHANNELS) {
+			fprintf(stderr, "WARNING: Only the first %d channels of %s are used.\n",
+				HOP_MAX_CHANNELS, path);
+			break;
+		}
+		c = &h->channels[h->count];
+		c->freq = (uint32_t)atofs(freq);
+		c->dwell = n >= 2 ? atoft(dwell) : HOP_DEFAULT_DWELL;
+		if (c->freq == 0 || c->dwell <= 0.0) {
+			fprintf(stderr, "Bad channel on line %d of %s.\n", line_no, path);
+			fclose(f);
+			return -1;
+		}
+		snprintf(c->label, HOP_LABEL, "%s", n >= 3 ? label : "");
+		c->last_db = -100.0f;
+		c->peak_db = -100.0f;
+		h->count++;
+	}
+	fclose(f);
+	if (h->count == 0) {
+		fprintf(stderr, "No channels in hop list %s.\n", path);
+		return -1;
+	}
+	h->samp_rate = samp_rate;
+	h->settle_len = usb_bytes(settle, samp_rate);
+	h->level = (uint32_t)(32768.0 * pow(10.0, level_db / 10.0));
+	plan_step(h, 0);
+	pthread_mutex_init(&h->lock, NULL);
+	fprintf(stderr, "Hopping %d channels, %0.1f ms settle, busy at %0.1f dBFS.\n",
+		h->count, settle * 1000.0, level_db);
+	return 0;
+}
+
+int hop_retune(struct hop_scheduler *h, rtlsdr_dev_t *dev, struct hop_step *step)
+{
+	struct timespec t0, t1;
+	int64_t ns;
+	int r = 0;
+	*step = h->next;
+	if (step->freq == h->tuned) {
+		step->settle_len = 0;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		/* log the first pass through the list only, after that
+		 * every channel is known to tune */
+		if (h->hops < (uint64_t)h->count) {
+			r = verbose_set_frequency(dev, step->freq);
+		} else {
+			r = rtlsdr_set_center_freq(dev, step->freq);}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ns = (int64_t)(t1.tv_sec - t0.tv_sec) * 1000000000 + (t1.tv_nsec - t0.tv_nsec);
+		if (h->hops == 0) {
+			h->first_hop = t0;}
+		h->hops++;
+		h->retune_ns += ns;
+		if (ns > h->retune_max) {
+			h->retune_max = ns;}
+		h->tuned = r < 0 ? 0 : step->freq;
+		if (r < 0) {
+			h->failures++;}
+	}
+	plan_step(h, (step->channel + 1) % h->count);
+	return r < 0 ? -1 : 0;
+}
+
+static void finish_dwell(struct hop_scheduler *h)
+{
+	struct hop_channel *c = &h->channels[TAG_CHANNEL(h->tag)];
+	double mean = (double)h->energy_sum / h->samples;
+	int busy = h->energy_peak >= h->level;
+	float peak = energy_db(h->energy_peak);
+	pthread_mutex_lock(&h->lock);
+	c->visits++;
+	c->busy += busy;
+	c->power_sum += mean / 32768.0;
+	c->last_db = energy_db(mean);
+	c->last_busy = busy;
+	if (peak > c->peak_db) {
+		c->peak_db = peak;}
+	pthread_mutex_unlock(&h->lock);
+	h->energy_sum = 0;
+	h->samples = 0;
+	h->energy_peak = 0;
+}
+
+static void hop_block(struct hop_scheduler *h, struct pool_block *block)
+{
+	uint32_t energy, n = block->len / 2;
+	if (n == 0) {
+		return;}
+	/* a dwell whose last block was lost ends when the next begins */
+	if (h->samples && TAG_DWELL(block->tag) != TAG_DWELL(h->tag)) {
+		finish_dwell(h);}
+	energy = block_energy(block->data, block->len);
+	h->tag = block->tag;
+	h->energy_sum += (uint64_t)energy * n;
+	h->samples += n;
+	if (energy > h->energy_peak) {
+		h->energy_peak = energy;}
+	if (block->tag & HOP_TAG_LAST) {
+		finish_dwell(h);}
+}
+
+static void *hop_loop(void *arg)
+{
+	struct hop_scheduler *h = (struct hop_scheduler*)arg;
+	struct pool_block *block;
+	struct timespec idle = {0, 500000};
+	while (__atomic_load_n(&h->running, __ATOMIC_ACQUIRE)) {
+		block = block_pool_pop(h->pool, h->sub);
+		if (!block) {
+			nanosleep(&idle, NULL);
+			continue;
+		}
+		hop_block(h, block);
+		block_pool_release(h->pool, block);
+	}
+	while ((block = block_pool_pop(h->pool, h->sub)) != NULL) {
+		block_pool_release(h->pool, block);}
+	return NULL;
+}
+
+int hop_start(struct hop_scheduler *h, struct block_pool *pool)
+{
+	h->pool = pool;
+	h->sub = block_pool_subscribe(pool, HOP_QUEUE_DEPTH);
+	if (h->sub < 0) {
+		return -1;}
+	__atomic_store_n(&h->running, 1, __ATOMIC_RELEASE);
+	if (pthread_create(&h->thread, NULL, hop_loop, h) != 0) {
+		h->running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+int hop_levels(struct hop_scheduler *h, float *db, float *occupancy, int *busy, int max)
+{
+	int i, n = h->count < max ? h->count : max;
+	pthread_mutex_lock(&h->lock);
+	for (i = 0; i < n; i++) {
+		db[i] = h->channels[i].last_db;
+		occupancy[i] = h->channels[i].visits ?
+			(float)h->channels[i].busy / h->channels[i].visits : 0.0f;
+		busy[i] = h->channels[i].last_busy;
+	}
+	pthread_mutex_unlock(&h->lock);
+	return n;
+}
+
+void hop_stop(struct hop_scheduler *h)
+{
+	struct hop_channel *c;
+	struct timespec now;
+	double secs;
+	int i;
+	if (h->running) {
+		__atomic_store_n(&h->running, 0, __ATOMIC_RELEASE);
+		pthread_join(h->thread, NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = (now.tv_sec - h->first_hop.tv_sec) + (now.tv_nsec - h->first_hop.tv_nsec) / 1e9;
+	if (h->hops) {
+		fprintf(stderr, "Hops: %llu in %0.1f s (%0.1f/s), retune %0.2f ms average, %0.2f ms max, %u failed.\n",
+			(unsigned long long)h->hops, secs, h->hops / secs, h->retune_ns / 1e6 / h->hops,
+			h->retune_max / 1e6, h->failures);
+	}
+	fprintf(stderr, "%12s %-12s %8s %7s %9s %9s\n", "MHz", "label", "visits", "busy", "mean dB", "peak dB");
+	for (i = 0; i < h->count; i++) {
+		c = &h->channels[i];
+		fprintf(stderr, "%12.4f %-12s %8llu %6.1f%% %9.1f %9.1f\n", c->freq / 1e6, c->label,
+			(unsigned long long)c->visits, c->visits ? 100.0 * c->busy / c->visits : 0.0,
+			c->visits ? 10.0 * log10(c->power_sum / c->visits) : -100.0, c->peak_db);
+	}
+	pthread_mutex_destroy(&h->lock);
+}
+
+// vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
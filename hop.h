@@ -0,0 +1,149 @@
+#ifndef HOP_H
+#define HOP_H
+
+/* hop list scheduler.  cycles the tuner through a list of channels,
+ * each with its own dwell time.  the acquisition thread calls
+ * hop_retune() as soon as the last block of a dwell is published, so
+ * the retune and settling overlap the hop thread measuring that dwell.
+ * blocks carry their dwell in pool_block.tag, the last block of each
+ * dwell has HOP_TAG_LAST set.
+ *
+ * a hop list has one channel per line, dwell in seconds (atoft
+ * suffixes) and the label are optional:
+ *
+ *	# frequency	dwell	label
+ *	118.1M		0.05	tower
+ *	121.5M		0.05s	guard
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "rtl-sdr.h"
+#include "block_pool.h"
+
+#define HOP_MAX_CHANNELS	256
+#define HOP_LABEL		24
+/* the hop thread only sums energy, it rarely lags by more than a block */
+#define HOP_QUEUE_DEPTH		16
+#define HOP_DEFAULT_DWELL	0.1
+/* a dwell is busy when one of its blocks reaches the level */
+#define HOP_DEFAULT_LEVEL	-30.0
+/* tag of the last block of a dwell, the low byte is the channel */
+#define HOP_TAG_LAST		0x80000000u
+
+struct hop_channel
+{
+	uint32_t freq;
+	double dwell;
+	char label[HOP_LABEL];
+	/* written by the hop thread under the scheduler lock */
+	uint64_t visits;
+	uint64_t busy;
+	double power_sum;
+	float last_db;
+	float peak_db;
+	int last_busy;
+};
+
+/* everything the acquisition thread needs for one dwell */
+struct hop_step
+{
+	int channel;
+	uint32_t freq;
+	uint32_t settle_len;
+	uint32_t dwell_len;
+	uint32_t tag;
+};
+
+struct hop_scheduler
+{
+	struct hop_channel channels[HOP_MAX_CHANNELS];
+	int count;
+	uint32_t samp_rate;
+	uint32_t settle_len;
+	uint32_t level;
+	/* acquisition thread only, next is worked out a dwell ahead */
+	struct hop_step next;
+	uint32_t tuned;
+	uint32_t dwells;
+	uint64_t hops;
+	uint32_t failures;
+	int64_t retune_ns;
+	int64_t retune_max;
+	struct timespec first_hop;
+	/* hop thread only, the dwell being measured */
+	struct block_pool *pool;
+	int sub;
+	uint32_t tag;
+	uint64_t energy_sum;
+	uint64_t samples;
+	uint32_t energy_peak;
+	int running;
+	pthread_t thread;
+	pthread_mutex_t lock;
+};
+
+/*!
+ * Read a hop list and work out the first dwell
+ *
+ * \param h the scheduler to initialize
+ * \param path hop list file
+ * \param samp_rate in samples/second
+ * \param settle seconds of samples thrown away after each retune
+ * \param level_db dBFS a block must reach for its dwell to count as busy
+ * \return 0 on success
+ */
+
+int hop_load(struct hop_scheduler *h, const char *path, uint32_t samp_rate,
+	double settle, double level_db);
+
+/*!
+ * Subscribe to the sample pool and start the hop thread,
+ * call before acquisition starts
+ *
+ * \param h the scheduler given to hop_load()
+ * \param pool the sample pool
+ * \return 0 on success
+ */
+
+int hop_start(struct hop_scheduler *h, struct block_pool *pool);
+
+/*!
+ * Tune to the dwell worked out last time and work out the one after,
+ * acquisition thread only.  the first settle_len bytes read after this
+ * are to be thrown away, the next dwell_len bytes published with the
+ * step's tag.
+ *
+ * \param h the scheduler given to hop_load()
+ * \param dev the device
+ * \param step filled with the dwell to capture, settle_len is 0 when
+ *        the tuner is already there
+ * \return 0 on success, -1 if the tuner refused, step then holds the
+ *         channel that failed and the caller moves on
+ */
+
+int hop_retune(struct hop_scheduler *h, rtlsdr_dev_t *dev, struct hop_step *step);
+
+/*!
+ * Copy out the latest level and occupancy of every channel, any thread
+ *
+ * \param h the scheduler given to hop_load()
+ * \param db last dwell power per channel in dBFS
+ * \param occupancy fraction of busy dwells per channel
+ * \param busy whether the last dwell was busy
+ * \param max room in the arrays
+ * \return number of channels copied
+ */
+
+int hop_levels(struct hop_scheduler *h, float *db, float *occupancy, int *busy, int max);
+
+/*!
+ * Stop the hop thread and print the per channel statistics
+ *
+ * \param h the scheduler given to hop_load()
+ */
+
+void hop_stop(struct hop_scheduler *h);
+
+#endif
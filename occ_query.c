@@ -0,0 +1,119 @@
+/* query the spectrum occupancy database written by demo -O */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "units.h"
+#include "occupancy.h"
+
+void usage(void)
+{
+	fprintf(stderr,
+		"occ_query, occupancy statistics from a demo -O database\n\n"
+		"Usage:\tocc_query -d base -f low_freq -F high_freq [-options]\n"
+		"\t-d database path without extension\n"
+		"\t-f lowest frequency of the window\n"
+		"\t-F highest frequency of the window\n"
+		"\t[-s start (default: beginning of the data)]\n"
+		"\t[-e end (default: now)]\n"
+		"\t[-l busy_level (default: -60 dB)]\n"
+		"\ttimes are unix seconds, 'YYYY-MM-DD HH:MM:SS',\n"
+		"\t'YYYY-MM-DD' or relative to now like -24h\n");
+	exit(1);
+}
+
+int64_t parse_time(char *s)
+{
+	struct tm tm;
+	char *end;
+	long long secs;
+	if (s[0] == '-') {
+		return (int64_t)time(NULL) * 1000 - (int64_t)(atoft(s + 1) * 1000.0);}
+	secs = strtoll(s, &end, 10);
+	if (end[0] == '\0') {
+		return (int64_t)secs * 1000;}
+	memset(&tm, 0, sizeof(tm));
+	if (!strptime(s, "%Y-%m-%d %H:%M:%S", &tm) && !strptime(s, "%Y-%m-%dT%H:%M:%S", &tm)) {
+		memset(&tm, 0, sizeof(tm));
+		if (!strptime(s, "%Y-%m-%d", &tm)) {
+			fprintf(stderr, "Can't parse time %s.\n", s);
+			exit(1);
+		}
+	}
+	tm.tm_isdst = -1;
+	return (int64_t)mktime(&tm) * 1000;
+}
+
+void print_time(const char *label, int64_t ms)
+{
+	char buf[32];
+	time_t t = (time_t)(ms / 1000);
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	printf("%s%s\n", label, buf);
+}
+
+int main(int argc, char **argv)
+{
+	struct occ_query q;
+	struct occ_result r;
+	struct timespec t0, t1;
+	char *base = NULL;
+	int opt;
+	memset(&q, 0, sizeof(q));
+	q.t_end = (int64_t)time(NULL) * 1000;
+	q.level_db = -60.0f;
+	while ((opt = getopt(argc, argv, "d:f:F:s:e:l:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			base = optarg;
+			break;
+		case 'f':
+			q.f_low = (uint64_t)atofs(optarg);
+			break;
+		case 'F':
+			q.f_high = (uint64_t)atofs(optarg);
+			break;
+		case 's':
+			q.t_start = parse_time(optarg);
+			break;
+		case 'e':
+			q.t_end = parse_time(optarg);
+			break;
+		case 'l':
+			q.level_db = (float)atof(optarg);
+			break;
+		case 'h':
+		default:
+			usage();
+			break;
+		}
+	}
+	if (!base || q.f_high <= q.f_low) {
+		usage();}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (occupancy_query(base, &q, &r) < 0) {
+		return 1;}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	printf("Window: %0.4f - %0.4f MHz, busy at %0.1f dB\n",
+		q.f_low / 1e6, q.f_high / 1e6, q.level_db);
+	printf("Rows: %llu, busy: %llu (%0.2f %%)\n", (unsigned long long)r.rows,
+		(unsigned long long)r.busy_rows, r.rows ? 100.0 * r.busy_rows / r.rows : 0.0);
+	if (r.busy_rows) {
+		print_time("First busy: ", r.first_busy);
+		print_time("Last busy:  ", r.last_busy);
+	}
+	if (r.rows) {
+		printf("Peak: %0.1f dB, mean: %0.1f dB\n", r.peak_db, r.mean_db);}
+	printf("Blocks: %u in window, %u read from data\n", r.blocks, r.blocks_read);
+	printf("Query took %0.3f ms\n", (t1.tv_sec - t0.tv_sec) * 1000.0
+		+ (t1.tv_nsec - t0.tv_nsec) / 1000000.0);
+	return 0;
+}
+
+// vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
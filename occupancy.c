@@ -0,0 +1,363 @@
+/* spectrum occupancy database, see occupancy.h for the file layout */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "occupancy.h"
+
+#define BAND_BINS		(OCC_BINS / OCC_BANDS)
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int64_t capture_ms(const struct spectrum_row *row)
+/* wall clock time of the row's newest sample, rows without a capture
+ * time are stamped on arrival */
+{
+	struct timespec mono;
+	if (row->capture_ns == 0) {
+		return now_ms();}
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	return now_ms() - ((int64_t)mono.tv_sec * 1000000000 + mono.tv_nsec - row->capture_ns) / 1000000;
+}
+
+static uint8_t quantize(float db)
+{
+	float q = (db - OCC_DB_MIN) * 2.0f;
+	if (q < 0.0f) {
+		return 0;}
+	if (q > 255.0f) {
+		return 255;}
+	return (uint8_t)q;
+}
+
+static float level_of(double q)
+{
+	return OCC_DB_MIN + (float)q / 2.0f;
+}
+
+static void flush_block(struct occupancy_writer *w)
+{
+	struct occ_index_entry *e = &w->entry;
+	uint32_t k, j, b, sum;
+	uint8_t lo, hi, v;
+	if (e->rows == 0) {
+		return;}
+	for (b = 0; b < OCC_BANDS; b++) {
+		lo = 255;
+		hi = 0;
+		sum = 0;
+		for (k = b * BAND_BINS; k < (b + 1) * BAND_BINS; k++) {
+			for (j = 0; j < e->rows; j++) {
+				v = w->columns[k][j];
+				if (v < lo) {
+					lo = v;}
+				if (v > hi) {
+					hi = v;}
+				sum += v;
+			}
+		}
+		e->band_min[b] = lo;
+		e->band_max[b] = hi;
+		e->band_mean[b] = (uint8_t)(sum / (BAND_BINS * e->rows));
+	}
+	e->t_first = w->times[0];
+	e->t_last = w->times[e->rows - 1];
+	e->bins = OCC_BINS;
+	e->offset = w->offset;
+	fwrite(w->times, sizeof(int64_t), e->rows, w->data);
+	for (k = 0; k < OCC_BINS; k++) {
+		fwrite(w->columns[k], 1, e->rows, w->data);}
+	/* data first, so an index entry always has its block behind it */
+	fflush(w->data);
+	w->offset += (uint64_t)e->rows * (sizeof(int64_t) + OCC_BINS);
+	fwrite(e, sizeof(struct occ_index_entry), 1, w->index);
+	fflush(w->index);
+	e->rows = 0;
+}
+
+static void append_row(struct occupancy_writer *w, const struct occ_row *row)
+{
+	struct occ_index_entry *e = &w->entry;
+	uint32_t k;
+	if (e->rows > 0 && (row->center_freq != e->center_freq || row->samp_rate != e->samp_rate)) {
+		flush_block(w);}
+	if (e->rows == 0) {
+		e->center_freq = row->center_freq;
+		e->samp_rate = row->samp_rate;
+	}
+	w->times[e->rows] = row->time;
+	for (k = 0; k < OCC_BINS; k++) {
+		w->columns[k][e->rows] = row->bins[k];}
+	e->rows++;
+	if (e->rows == OCC_BLOCK_ROWS) {
+		flush_block(w);}
+}
+
+static void push_row(struct occupancy_writer *w, const struct occ_row *row)
+{
+	pthread_mutex_lock(&w->lock);
+	if (w->pending_tail - w->pending_head < OCC_PENDING) {
+		w->pending[w->pending_tail % OCC_PENDING] = *row;
+		w->pending_tail++;
+		pthread_cond_signal(&w->ready);
+	} else {
+		w->lost_rows++;}
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void *writer_loop(void *arg)
+{
+	struct occupancy_writer *w = (struct occupancy_writer*)arg;
+	struct occ_row row;
+	for (;;) {
+		pthread_mutex_lock(&w->lock);
+		while (w->running && w->pending_head == w->pending_tail) {
+			pthread_cond_wait(&w->ready, &w->lock);}
+		if (w->pending_head == w->pending_tail) {
+			pthread_mutex_unlock(&w->lock);
+			break;
+		}
+		row = w->pending[w->pending_head % OCC_PENDING];
+		w->pending_head++;
+		pthread_mutex_unlock(&w->lock);
+		append_row(w, &row);
+	}
+	flush_block(w);
+	return NULL;
+}
+
+int occupancy_open(struct occupancy_writer *w, const char *base, double interval)
+{
+	char path[1024];
+	memset(w, 0, sizeof(struct occupancy_writer));
+	snprintf(path, sizeof(path), "%s.occ", base);
+	w->data = fopen(path, "ab");
+	snprintf(path, sizeof(path), "%s.idx", base);
+	w->index = fopen(path, "ab");
+	if (!w->data || !w->index) {
+		fprintf(stderr, "Failed to open occupancy database %s.\n", base);
+		if (w->data) {
+			fclose(w->data);}
+		if (w->index) {
+			fclose(w->index);}
+		return -1;
+	}
+	fseek(w->data, 0, SEEK_END);
+	w->offset = (uint64_t)ftell(w->data);
+	w->interval_ms = (int64_t)(interval * 1000.0);
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->ready, NULL);
+	w->running = 1;
+	if (pthread_create(&w->thread, NULL, writer_loop, w) != 0) {
+		fclose(w->data);
+		fclose(w->index);
+		return -1;
+	}
+	fprintf(stderr, "Recording occupancy to %s every %0.1f s.\n", base, interval);
+	return 0;
+}
+
+void occupancy_sink(void *ctx, const struct spectrum_row *row)
+{
+	struct occupancy_writer *w = (struct occupancy_writer*)ctx;
+	uint32_t group = row->bins / OCC_BINS;
+	uint32_t i, k;
+	int64_t now = capture_ms(row);
+	float peak;
+	uint8_t q;
+	if (w->hold_rows > 0 && (now - w->hold.time >= w->interval_ms
+	    || row->center_freq != w->hold.center_freq || row->samp_rate != w->hold.samp_rate)) {
+		push_row(w, &w->hold);
+		w->hold_rows = 0;
+	}
+	if (w->hold_rows == 0) {
+		w->hold.time = now;
+		w->hold.center_freq = row->center_freq;
+		w->hold.samp_rate = row->samp_rate;
+		memset(w->hold.bins, 0, OCC_BINS);
+	}
+	for (i = 0; i < OCC_BINS; i++) {
+		peak = row->db[i * group];
+		for (k = 1; k < group; k++) {
+			if (row->db[i * group + k] > peak) {
+				peak = row->db[i * group + k];}
+		}
+		q = quantize(peak);
+		if (q > w->hold.bins[i]) {
+			w->hold.bins[i] = q;}
+	}
+	w->hold_rows++;
+}
+
+void occupancy_close(struct occupancy_writer *w)
+{
+	if (w->hold_rows > 0) {
+		push_row(w, &w->hold);
+		w->hold_rows = 0;
+	}
+	pthread_mutex_lock(&w->lock);
+	w->running = 0;
+	pthread_cond_signal(&w->ready);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+	if (w->lost_rows) {
+		fprintf(stderr, "Occupancy writer fell behind, lost %u rows.\n", w->lost_rows);}
+	fclose(w->data);
+	fclose(w->index);
+}
+
+static void *map_file(const char *path, size_t *len)
+{
+	struct stat st;
+	void *p;
+	int fd = open(path, O_RDONLY);
+	*len = 0;
+	if (fd < 0) {
+		return NULL;}
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return NULL;}
+	*len = st.st_size;
+	return p;
+}
+
+static void query_block(const struct occ_index_entry *e, const uint8_t *data,
+	const struct occ_query *q, uint32_t k0, uint32_t k1, int level, struct occ_result *r,
+	double *sum, uint64_t *cells)
+{
+	const int64_t *times = (const int64_t*)(data + e->offset);
+	const uint8_t *col;
+	uint8_t row_max[OCC_BLOCK_ROWS];
+	uint32_t j, j0 = 0, j1 = e->rows, k, b;
+	uint8_t band_max = 0, v;
+	double band_mean = 0.0;
+	if (e->t_first < q->t_start || e->t_last > q->t_end) {
+		/* partially inside, the time column says which rows count */
+		while (j0 < e->rows && times[j0] < q->t_start) {
+			j0++;}
+		while (j1 > j0 && times[j1 - 1] > q->t_end) {
+			j1--;}
+	}
+	if (j0 >= j1) {
+		return;}
+	r->rows += j1 - j0;
+	for (b = k0 / BAND_BINS; b <= k1 / BAND_BINS; b++) {
+		if (e->band_max[b] > band_max) {
+			band_max = e->band_max[b];}
+		band_mean += e->band_mean[b];
+	}
+	if (band_max < level) {
+		/* nothing in these bands reaches the level, the summaries answer */
+		band_mean /= k1 / BAND_BINS - k0 / BAND_BINS + 1;
+		*sum += band_mean * (j1 - j0) * (k1 - k0 + 1);
+		*cells += (uint64_t)(j1 - j0) * (k1 - k0 + 1);
+		if (level_of(band_max) > r->peak_db) {
+			r->peak_db = level_of(band_max);}
+		return;
+	}
+	r->blocks_read++;
+	memset(row_max, 0, sizeof(row_max));
+	for (k = k0; k <= k1; k++) {
+		col = data + e->offset + (uint64_t)e->rows * sizeof(int64_t) + (uint64_t)k * e->rows;
+		for (j = j0; j < j1; j++) {
+			v = col[j];
+			*sum += v;
+			if (v > row_max[j]) {
+				row_max[j] = v;}
+		}
+	}
+	*cells += (uint64_t)(j1 - j0) * (k1 - k0 + 1);
+	for (j = j0; j < j1; j++) {
+		if (level_of(row_max[j]) > r->peak_db) {
+			r->peak_db = level_of(row_max[j]);}
+		if (row_max[j] < level) {
+			continue;}
+		r->busy_rows++;
+		if (r->first_busy == 0) {
+			r->first_busy = times[j];}
+		r->last_busy = times[j];
+	}
+}
+
+int occupancy_query(const char *base, const struct occ_query *q, struct occ_result *r)
+{
+	char path[1024];
+	size_t index_len, data_len, count, lo, hi, i;
+	const struct occ_index_entry *index;
+	const struct occ_index_entry *e;
+	const uint8_t *data;
+	double f_lo, bin_width, sum = 0.0;
+	uint64_t cells = 0;
+	int64_t k0, k1;
+	/* lowest stored value at or above the level */
+	int level = quantize(q->level_db);
+	if (q->level_db > level_of(level)) {
+		level++;}
+	memset(r, 0, sizeof(struct occ_result));
+	r->peak_db = OCC_DB_MIN;
+	snprintf(path, sizeof(path), "%s.idx", base);
+	index = (const struct occ_index_entry*)map_file(path, &index_len);
+	if (!index) {
+		fprintf(stderr, "No occupancy index at %s.\n", path);
+		return -1;
+	}
+	snprintf(path, sizeof(path), "%s.occ", base);
+	data = (const uint8_t*)map_file(path, &data_len);
+	if (!data) {
+		munmap((void*)index, index_len);
+		return -1;
+	}
+	count = index_len / sizeof(struct occ_index_entry);
+	/* blocks are in time order, find the first one ending in the window */
+	lo = 0;
+	hi = count;
+	while (lo < hi) {
+		i = (lo + hi) / 2;
+		if (index[i].t_last < q->t_start) {
+			lo = i + 1;
+		} else {
+			hi = i;}
+	}
+	for (i = lo; i < count && index[i].t_first <= q->t_end; i++) {
+		e = &index[i];
+		if (e->offset + (uint64_t)e->rows * (sizeof(int64_t) + e->bins) > data_len) {
+			break;}
+		bin_width = (double)e->samp_rate / e->bins;
+		f_lo = (double)e->center_freq - e->samp_rate / 2.0;
+		k0 = (int64_t)floor((q->f_low - f_lo) / bin_width);
+		k1 = (int64_t)ceil((q->f_high - f_lo) / bin_width) - 1;
+		if (k0 < 0) {
+			k0 = 0;}
+		if (k1 >= e->bins) {
+			k1 = e->bins - 1;}
+		if (k0 > k1) {
+			continue;}
+		r->blocks++;
+		query_block(e, data, q, (uint32_t)k0, (uint32_t)k1, level, r, &sum, &cells);
+	}
+	if (cells) {
+		r->mean_db = level_of(sum / cells);}
+	munmap((void*)index, index_len);
+	munmap((void*)data, data_len);
+	return 0;
+}
+
+// vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
@@ -0,0 +1,143 @@
+#ifndef OCCUPANCY_H
+#define OCCUPANCY_H
+
+/* spectrum occupancy database.
+ *
+ * spectrum rows are peak held over a fixed interval, squeezed to
+ * OCC_BINS bins of 0.5 dB steps and appended to <base>.occ in blocks
+ * of up to OCC_BLOCK_ROWS rows.  a block never spans a retune.  inside
+ * a block the data is columnar: the row times first, then each bin's
+ * values over all rows, so a frequency window only touches its own
+ * columns.
+ *
+ * <base>.idx gets one fixed size entry per block with the block's time
+ * span, tuning and per band min/max/mean.  queries memory map the
+ * index, binary search the time window and only open a block's data
+ * when its summaries cannot answer for it.  both files are append
+ * only, the index entry is written after its block so a reader never
+ * sees an entry without data. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "spectrum.h"
+
+#define OCC_BINS		256
+#define OCC_BLOCK_ROWS		256
+#define OCC_BANDS		16
+#define OCC_PENDING		64
+/* stored value q stands for OCC_DB_MIN + q/2 dB */
+#define OCC_DB_MIN		-127.5f
+
+struct occ_index_entry
+{
+	uint64_t offset;
+	/* ms since the epoch */
+	int64_t t_first;
+	int64_t t_last;
+	uint64_t center_freq;
+	uint32_t samp_rate;
+	uint16_t rows;
+	uint16_t bins;
+	uint8_t band_min[OCC_BANDS];
+	uint8_t band_max[OCC_BANDS];
+	uint8_t band_mean[OCC_BANDS];
+};
+
+struct occ_row
+{
+	int64_t time;
+	uint64_t center_freq;
+	uint32_t samp_rate;
+	uint8_t bins[OCC_BINS];
+};
+
+struct occupancy_writer
+{
+	FILE *data;
+	FILE *index;
+	uint64_t offset;
+	int64_t interval_ms;
+	/* peak hold of the current interval, engine thread only */
+	struct occ_row hold;
+	int hold_rows;
+	/* rows waiting for the writer thread */
+	struct occ_row pending[OCC_PENDING];
+	uint32_t pending_head;
+	uint32_t pending_tail;
+	uint32_t lost_rows;
+	/* block being filled, writer thread only */
+	int64_t times[OCC_BLOCK_ROWS];
+	uint8_t columns[OCC_BINS][OCC_BLOCK_ROWS];
+	struct occ_index_entry entry;
+	int running;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+};
+
+struct occ_query
+{
+	int64_t t_start;
+	int64_t t_end;
+	uint64_t f_low;
+	uint64_t f_high;
+	/* a row is busy when any bin in the window reaches this level */
+	float level_db;
+};
+
+struct occ_result
+{
+	uint64_t rows;
+	uint64_t busy_rows;
+	int64_t first_busy;
+	int64_t last_busy;
+	/* exact for blocks read from data, blocks answered by their
+	 * summaries contribute the values of the bands they overlap */
+	float peak_db;
+	float mean_db;
+	uint32_t blocks;
+	uint32_t blocks_read;
+};
+
+/*!
+ * Open or create a database for appending and start its writer thread
+ *
+ * \param w the writer to initialize
+ * \param base path without the .occ/.idx extension
+ * \param interval seconds of spectrum peak held into each stored row
+ * \return 0 on success
+ */
+
+int occupancy_open(struct occupancy_writer *w, const char *base, double interval);
+
+/*!
+ * Spectrum sink, pass the writer as ctx to spectrum_add_sink()
+ *
+ * \param ctx the writer given to occupancy_open()
+ * \param row an averaged spectrum row
+ */
+
+void occupancy_sink(void *ctx, const struct spectrum_row *row);
+
+/*!
+ * Write out the partial block and close both files
+ *
+ * \param w the writer given to occupancy_open()
+ */
+
+void occupancy_close(struct occupancy_writer *w);
+
+/*!
+ * Occupancy statistics over a time and frequency window
+ *
+ * \param base path without the .occ/.idx extension
+ * \param q the window and busy level
+ * \param r filled with the statistics
+ * \return 0 on success
+ */
+
+int occupancy_query(const char *base, const struct occ_query *q, struct occ_result *r);
+
+#endif
@@ -14,8 +14,16 @@
 #include <math.h>
 #include "rtl-sdr.h"
 #include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "convenience.h"
+#include "block_pool.h"
+#include "trigger.h"
+#include "spectrum.h"
+#include "occupancy.h"
+#include "stream_server.h"
+#include "hop.h"
 
 #define MAX_RADIO_RESOLUTION 1024
 #define DEFAULT_SAMPLE_RATE		248000
@@ -28,6 +36,28 @@
 #define PPM_DURATION			10
 #define PPM_DUMP_TIME			5
 
+#define POOL_BLOCKS			64
+/* about 10 ms of samples per USB read */
+#define BLOCKS_PER_SECOND		100
+
+#define DEFAULT_FFT_SIZE		4096
+#define DEFAULT_OVERLAP			0.75
+#define DEFAULT_FRAMES_PER_ROW		4
+/* the int16 path is opt-in, it is only exact to about 40 dB below the
+ * strongest bin (see fixed_fft.h) and the display spans 80 dB */
+#define DEFAULT_FIXED_POINT		0
+#define DISPLAY_DB_MIN			-90.0f
+#define DISPLAY_DB_RANGE		80.0f
+#define DEFAULT_SETTLE			0.002
+#define HOP_BAR_DB_MIN			-50.0f
+#define HOP_BAR_DB_RANGE		50.0f
+/* us to wait once a whole pass of the hop list failed to tune */
+#define HOP_RETRY_DELAY			100000
+/* us to wait after a failed read, acquisition stops after
+ * READ_MAX_FAILURES of them in a row, about 5 s */
+#define READ_RETRY_DELAY		10000
+#define READ_MAX_FAILURES		500
+
 /* SDR vars */
 static rtlsdr_dev_t *dev = NULL;
 
@@ -36,6 +66,13 @@ static uint32_t samp_rate = DEFAULT_SAMPLE_RATE;
 static uint32_t total_samples = 0;
 static uint32_t dropped_samples = 0;
 static uint64_t curr_freq = 109000000;
+/* the UI only posts requested_freq, the acquisition thread retunes
+ * between reads so blocks are stamped with what they were captured at */
+static uint64_t requested_freq = 0;
+static uint64_t tuned_freq = 0;
+static int32_t tuner_gain = BLOCK_GAIN_AUTO;
+static uint64_t device_samples = 0;
+static uint32_t lost_since_publish = 0;
 static int32_t delta_freq = 0;
 
 struct lineSegment
@@ -50,6 +87,59 @@ static int current_time = -1;
 static bool roll_time = false;
 static uint32_t out_block_size = DEFAULT_BUF_LENGTH;
 
+/* acquisition runs on its own thread and fans blocks out through the pool */
+static struct block_pool sample_pool;
+static pthread_t acquire_thread;
+static volatile int acquire_running = 0;
+/* set by the acquisition thread once the dongle stopped answering */
+static volatile int acquire_failed = 0;
+static int read_failures = 0;
+
+/* device setup overlaps window/GL setup, both log their phases */
+static struct timespec startup_begin;
+static pthread_t startup_thread;
+static int startup_result = -1;
+
+/* optional burst capture, enabled with -t */
+static struct burst_trigger burst;
+static bool trigger_enabled = false;
+static double trigger_db = -20.0;
+static double trigger_pre = 2.0;
+static double trigger_post = 2.0;
+
+/* FFT frames are batched over all cores, the display keeps the newest row */
+static struct spectrum_engine spectrum;
+static uint32_t fft_size = DEFAULT_FFT_SIZE;
+static double fft_overlap = DEFAULT_OVERLAP;
+static uint32_t frames_per_row = DEFAULT_FRAMES_PER_ROW;
+static int fixed_point = DEFAULT_FIXED_POINT;
+static pthread_mutex_t display_lock = PTHREAD_MUTEX_INITIALIZER;
+static float display_row[MAX_RADIO_RESOLUTION];
+static bool display_row_ready = false;
+static int64_t display_capture_ns = 0;
+/* capture of a row's newest sample to the row being drawn */
+static uint64_t latency_rows = 0;
+static int64_t latency_sum = 0;
+static int64_t latency_max = 0;
+
+/* optional occupancy database, enabled with -O */
+static struct occupancy_writer occupancy;
+static char *occupancy_base = NULL;
+static double occupancy_interval = 1.0;
+
+/* optional spectrum server for remote viewers, enabled with -S */
+static struct stream_server stream;
+static int stream_port = 0;
+
+/* optional hop list, enabled with -H, channel bars replace the spectrum */
+static struct hop_scheduler hops;
+static char *hop_file = NULL;
+static double settle_time = DEFAULT_SETTLE;
+static double hop_level = HOP_DEFAULT_LEVEL;
+static float hop_db[HOP_MAX_CHANNELS];
+static float hop_occupancy[HOP_MAX_CHANNELS];
+static int hop_busy[HOP_MAX_CHANNELS];
+
 
 /*****
  *   VISUAL CONTROLS  *
@@ -93,6 +183,15 @@ static PFNGLUSEPROGRAMOBJECTARBPROC glUseProgramObjectARB;
 
 
 
+void log_startup_phase(const char *phase)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double ms = (now.tv_sec - startup_begin.tv_sec) * 1000.0
+		+ (now.tv_nsec - startup_begin.tv_nsec) / 1000000.0;
+	fprintf(stderr, "[startup %8.1f ms] %s\n", ms, phase);
+}
+
 float frand()
 {
 	return static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
@@ -153,6 +252,32 @@ void DrawGLScene(SDL_Window *window, GLuint texture, GLfloat * texcoord, float f
 	SDL_GL_SwapWindow(window);
 }
 
+void DrawHopBars(SDL_Window *window)
+{
+	int count = hop_levels(&hops, hop_db, hop_occupancy, hop_busy, HOP_MAX_CHANNELS);
+	GLfloat width = 5.6f / count;
+
+	glDisable(GL_DEPTH_TEST);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glLoadIdentity();
+	glBegin(GL_QUADS);
+	for(int i = 0; i < count; ++i)
+	{
+		/* height is the last dwell's power, colour goes from green to red with occupancy */
+		GLfloat h = (hop_db[i] - HOP_BAR_DB_MIN) / HOP_BAR_DB_RANGE;
+		h = h < 0.01f ? 0.01f : (h > 1.0f ? 1.0f : h);
+		GLfloat x = -2.8f + i * width;
+		glColor4f(0.2f + 0.8f * hop_occupancy[i], 1.0f - 0.7f * hop_occupancy[i], 0.2f, hop_busy[i] ? 1.0f : 0.55f);
+		glVertex3f(x, -1.5f, 0.0f);
+		glVertex3f(x + width * 0.8f, -1.5f, 0.0f);
+		glVertex3f(x + width * 0.8f, -1.5f + h * 3.0f, 0.0f);
+		glVertex3f(x, -1.5f + h * 3.0f, 0.0f);
+	}
+	glEnd();
+	glEnable(GL_DEPTH_TEST);
+	SDL_GL_SwapWindow(window);
+}
+
 
 int init_sdr()
 {
@@ -163,9 +288,16 @@ int init_sdr()
 	int count;
 	int gains[100];
 
+	out_block_size = samp_rate * 2 / BLOCKS_PER_SECOND;
+	out_block_size -= out_block_size % MINIMAL_BUF_LENGTH;
+	if(out_block_size < MINIMAL_BUF_LENGTH)
+		out_block_size = MINIMAL_BUF_LENGTH;
+	if(out_block_size > MAXIMAL_BUF_LENGTH)
+		out_block_size = MAXIMAL_BUF_LENGTH;
 	rtl_buffer = malloc(out_block_size * sizeof(uint8_t));
 
 	dev_index = verbose_device_search("0");
+	log_startup_phase("devices enumerated");
 
 	if (dev_index < 0) {
 		return -1;
@@ -176,6 +308,7 @@ int init_sdr()
 		fprintf(stderr, "Failed to open rtlsdr device #%d.\n", dev_index);
 		return -1;
 	}
+	log_startup_phase("device opened");
 	
 	verbose_set_sample_rate(dev, samp_rate);
 
@@ -183,8 +316,11 @@ int init_sdr()
 
 	rtlsdr_set_tuner_gain_mode(dev,0);
 	rtlsdr_set_center_freq(dev,curr_freq);	
+	tuned_freq = curr_freq;
+	__atomic_store_n(&requested_freq, curr_freq, __ATOMIC_RELAXED);
 	rtlsdr_set_tuner_bandwidth(dev,22000);
 	verbose_reset_buffer(dev);
+	log_startup_phase("device configured");
 	return r;
 
 }
@@ -205,16 +341,298 @@ int rtl_read_buffer()
 	int n_read;	
 
 	int r = rtlsdr_read_sync(dev, rtl_buffer, out_block_size, &n_read);
-	
+	if(r < 0)
+		return r;
+	return n_read;
+}
+
+void stamp_block(struct pool_block *block, uint64_t freq, int64_t done_ns)
+{
+	uint32_t samples = block->len / 2;
+	/* the read returns with the last sample, work back to the first */
+	block->meta.capture_ns = done_ns - (int64_t)samples * 1000000000 / samp_rate;
+	block->meta.sample = device_samples;
+	block->meta.center_freq = freq;
+	block->meta.gain = tuner_gain;
+	block->meta.dropped_before = lost_since_publish;
+	device_samples += samples;
+	lost_since_publish = 0;
+}
+
+void count_lost(int n_read)
+{
+	if(n_read <= 0)
+		return;
+	dropped_samples += n_read / 2;
+	lost_since_publish += n_read / 2;
+	device_samples += n_read / 2;
+}
+
+void read_backoff()
+/* a dongle that is unplugged or wedged fails every read at once */
+{
+	if(read_failures++ == 0)
+		fprintf(stderr, "WARNING: Failed to read samples, retrying.\n");
+	if(read_failures >= READ_MAX_FAILURES)
+	{
+		fprintf(stderr, "Stopping acquisition after %d failed reads.\n", read_failures);
+		acquire_failed = 1;
+		return;
+	}
+	usleep(READ_RETRY_DELAY);
+}
+
+void apply_retune()
+{
+	uint64_t freq = __atomic_load_n(&requested_freq, __ATOMIC_RELAXED);
+	uint32_t left, len;
+	int n_read;
+	if(freq == tuned_freq)
+		return;
+	if(rtlsdr_set_center_freq(dev, (uint32_t)freq) < 0)
+	{
+		fprintf(stderr, "WARNING: Failed to tune to %llu Hz.\n", (unsigned long long)freq);
+		/* drop the request unless a newer one came in meanwhile */
+		__atomic_compare_exchange_n(&requested_freq, &freq, tuned_freq, false,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+		return;
+	}
+	tuned_freq = freq;
+	/* whatever the tuner delivers while settling is thrown away */
+	left = ((uint32_t)(settle_time * samp_rate) * 2 + MINIMAL_BUF_LENGTH - 1) & ~(MINIMAL_BUF_LENGTH - 1);
+	for(; left > 0; left -= len)
+	{
+		len = left < out_block_size ? left : out_block_size;
+		if(rtlsdr_read_sync(dev, rtl_buffer, len, &n_read) == 0)
+			device_samples += n_read / 2;
+	}
+}
+
+void *acquire_loop(void *arg)
+{
+	struct pool_block *block;
+	int n_read;
+	bool first = true;
+	while(acquire_running && !acquire_failed)
+	{
+		apply_retune();
+		block = block_pool_acquire(&sample_pool);
+		if(block == NULL)
+		{
+			/* every block is still being read, keep the stream flowing */
+			n_read = rtl_read_buffer();
+			if(n_read < 0)
+			{
+				read_backoff();
+				continue;
+			}
+			read_failures = 0;
+			count_lost(n_read);
+			continue;
+		}
+		if(rtlsdr_read_sync(dev, block->data, out_block_size, &n_read) < 0)
+		{
+			block_pool_release(&sample_pool, block);
+			read_backoff();
+			continue;
+		}
+		read_failures = 0;
+		block->len = n_read;
+		stamp_block(block, tuned_freq, block_clock_ns());
+		total_samples += n_read / 2;
+		block_pool_publish(&sample_pool, block);
+		if(first)
+		{
+			log_startup_phase("first samples");
+			first = false;
+		}
+	}
+	return NULL;
+}
+
+void *hop_acquire_loop(void *arg)
+{
+	struct pool_block *block;
+	struct hop_step step;
+	uint32_t left, len;
+	int n_read, failed = 0;
+	bool first = true, warned = false;
+	while(acquire_running && !acquire_failed)
+	{
+		/* the hop thread measures the previous dwell meanwhile */
+		if(hop_retune(&hops, dev, &step) < 0)
+		{
+			/* no channel tunes, don't spin against the tuner */
+			if(++failed >= hops.count)
+			{
+				if(!warned)
+					fprintf(stderr, "No hop channel tunes, retrying every %d ms.\n", HOP_RETRY_DELAY / 1000);
+				warned = true;
+				failed = 0;
+				usleep(HOP_RETRY_DELAY);
+			}
+			continue;
+		}
+		failed = 0;
+		for(left = step.settle_len; left > 0; left -= len)
+		{
+			len = left < out_block_size ? left : out_block_size;
+			if(rtlsdr_read_sync(dev, rtl_buffer, len, &n_read) == 0)
+				device_samples += n_read / 2;
+		}
+		for(left = step.dwell_len; left > 0 && acquire_running && !acquire_failed; left -= len)
+		{
+			len = left < out_block_size ? left : out_block_size;
+			block = block_pool_acquire(&sample_pool);
+			if(block == NULL)
+			{
+				if(rtlsdr_read_sync(dev, rtl_buffer, len, &n_read) < 0)
+				{
+					read_backoff();
+					continue;
+				}
+				read_failures = 0;
+				count_lost(n_read);
+				continue;
+			}
+			if(rtlsdr_read_sync(dev, block->data, len, &n_read) < 0)
+			{
+				block_pool_release(&sample_pool, block);
+				read_backoff();
+				continue;
+			}
+			read_failures = 0;
+			block->len = n_read;
+			block->tag = step.tag | (left == len ? HOP_TAG_LAST : 0);
+			stamp_block(block, step.freq, block_clock_ns());
+			total_samples += n_read / 2;
+			block_pool_publish(&sample_pool, block);
+			if(first)
+			{
+				log_startup_phase("first samples");
+				first = false;
+			}
+		}
+	}
+	return NULL;
+}
+
+void display_sink(void *ctx, const struct spectrum_row *row)
+{
+	/* peak hold while squeezing the row into the display width */
+	uint32_t group = row->bins / MAX_RADIO_RESOLUTION;
+	pthread_mutex_lock(&display_lock);
+	for(uint32_t i = 0; i < MAX_RADIO_RESOLUTION; ++i)
+	{
+		float peak = row->db[i * group];
+		for(uint32_t k = 1; k < group; ++k)
+			if(row->db[i * group + k] > peak)
+				peak = row->db[i * group + k];
+		display_row[i] = peak;
+	}
+	display_capture_ns = row->capture_ns;
+	display_row_ready = true;
+	pthread_mutex_unlock(&display_lock);
+}
+
+int start_acquisition()
+{
+	if(block_pool_init(&sample_pool, POOL_BLOCKS, out_block_size) < 0)
+		return -1;
+	if(hop_file != NULL)
+	{
+		if(hop_start(&hops, &sample_pool) < 0)
+			return -1;
+	}
+	else
+	{
+		if(spectrum_init(&spectrum, &sample_pool, fft_size, fft_overlap, frames_per_row, 0, fixed_point) < 0)
+			return -1;
+		spectrum_add_sink(&spectrum, display_sink, NULL);
+		spectrum_set_rate(&spectrum, samp_rate);
+	}
+	if(occupancy_base != NULL)
+	{
+		if(occupancy_open(&occupancy, occupancy_base, occupancy_interval) < 0)
+			return -1;
+		spectrum_add_sink(&spectrum, occupancy_sink, &occupancy);
+	}
+	if(stream_port > 0)
+	{
+		if(stream_open(&stream, stream_port, fft_size) < 0)
+			return -1;
+		spectrum_add_sink(&spectrum, stream_sink, &stream);
+	}
+	if(hop_file == NULL && spectrum_start(&spectrum) < 0)
+		return -1;
+	if(trigger_enabled)
+	{
+		if(trigger_init(&burst, &sample_pool, samp_rate, trigger_db, trigger_pre, trigger_post) < 0)
+			return -1;
+		if(trigger_start(&burst) < 0)
+			return -1;
+	}
+	acquire_running = 1;
+	if(pthread_create(&acquire_thread, NULL, hop_file ? hop_acquire_loop : acquire_loop, NULL) != 0)
+	{
+		acquire_running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+void *startup_sdr(void *arg)
+{
+	startup_result = init_sdr();
+	if(startup_result >= 0)
+		startup_result = start_acquisition();
+	return NULL;
+}
+
+void stop_acquisition()
+{
+	if(!acquire_running)
+		return;
+	acquire_running = 0;
+	pthread_join(acquire_thread, NULL);
+	if(hop_file != NULL)
+		hop_stop(&hops);
+	else
+		spectrum_stop(&spectrum);
+	if(occupancy_base != NULL)
+		occupancy_close(&occupancy);
+	if(stream_port > 0)
+		stream_close(&stream);
+	if(trigger_enabled)
+		trigger_stop(&burst);
+}
+
+int display_take_row()
+{
+	pthread_mutex_lock(&display_lock);
+	if(!display_row_ready)
+	{
+		pthread_mutex_unlock(&display_lock);
+		return 0;
+	}
+
 	int future = circular_future_time();
 
-	for(int i = 0; i < 1024; ++i)
+	for(int i = 0; i < MAX_RADIO_RESOLUTION; ++i)
 	{
+		GLfloat y = (display_row[i] - DISPLAY_DB_MIN) / DISPLAY_DB_RANGE;
 		stuff[future][i].x = i;
-		stuff[future][i].y = ((float)rtl_buffer[i])/255.0f;
+		stuff[future][i].y = y < 0.0f ? 0.0f : (y > 1.0f ? 1.0f : y);
 	}
+	display_row_ready = false;
+	int64_t latency = block_clock_ns() - display_capture_ns;
+	pthread_mutex_unlock(&display_lock);
 	current_time = future;
-	return r;
+	latency_rows++;
+	latency_sum += latency;
+	if(latency > latency_max)
+		latency_max = latency;
+	return 1;
 }
 
 
@@ -345,10 +763,101 @@ void random_zoom_control()
 		szzoom = frand()*0.021;
 }
 
+void usage(void)
+{
+	fprintf(stderr,
+		"sdr_demo, RTL-SDR spectrum in OpenGL\n\n"
+		"Usage:\tdemo [-options]\n"
+		"\t[-s samplerate (default: 248k Hz)]\n"
+		"\t[-n fft_size (default: 4096, at least 1024)]\n"
+		"\t[-o fft_overlap (default: 75%%)]\n"
+		"\t[-r frames_per_row (default: 4)]\n"
+		"\t[-d dsp_path float|fixed (default: float, fixed is faster on weak FPUs but only exact to ~40 dB down)]\n"
+		"\t[-t trigger_level (dBFS, enables burst capture)]\n"
+		"\t[-b pre_trigger_time (default: 2s)]\n"
+		"\t[-a post_trigger_time (default: 2s)]\n"
+		"\t[-O occupancy_database (path without extension, see occ_query)]\n"
+		"\t[-I occupancy_interval (default: 1s)]\n"
+		"\t[-S stream_port (serves the spectrum to stream_view or a browser)]\n"
+		"\t[-H hop_list (hop through channels, shows a bar per channel)]\n"
+		"\t[-T settle_time after a retune (default: 0.002s)]\n"
+		"\t[-L hop_busy_level (dBFS, default: -30)]\n");
+	exit(1);
+}
+
 int main(int argc, char **argv)
 {
-	int r = init_sdr();
-	if(r == -1)
+	int opt;
+	while ((opt = getopt(argc, argv, "s:n:o:r:d:t:b:a:O:I:S:H:T:L:h")) != -1) {
+		switch (opt) {
+		case 's':
+			samp_rate = (uint32_t)atofs(optarg);
+			break;
+		case 'n':
+			fft_size = (uint32_t)atoi(optarg);
+			break;
+		case 'o':
+			fft_overlap = atofp(optarg);
+			break;
+		case 'r':
+			frames_per_row = (uint32_t)atoi(optarg);
+			break;
+		case 'd':
+			if(strcmp(optarg, "fixed") == 0)
+				fixed_point = 1;
+			else if(strcmp(optarg, "float") == 0)
+				fixed_point = 0;
+			else
+				usage();
+			break;
+		case 't':
+			trigger_db = atof(optarg);
+			trigger_enabled = true;
+			break;
+		case 'b':
+			trigger_pre = atoft(optarg);
+			break;
+		case 'a':
+			trigger_post = atoft(optarg);
+			break;
+		case 'O':
+			occupancy_base = optarg;
+			break;
+		case 'I':
+			occupancy_interval = atoft(optarg);
+			break;
+		case 'S':
+			stream_port = atoi(optarg);
+			break;
+		case 'H':
+			hop_file = optarg;
+			break;
+		case 'T':
+			settle_time = atoft(optarg);
+			break;
+		case 'L':
+			hop_level = atof(optarg);
+			break;
+		case 'h':
+		default:
+			usage();
+			break;
+		}
+	}
+	if(fft_size < MAX_RADIO_RESOLUTION)
+		usage();
+	if(hop_file != NULL)
+	{
+		if(hop_load(&hops, hop_file, samp_rate, settle_time, hop_level) < 0)
+			return 1;
+		if(occupancy_base != NULL || stream_port > 0)
+			fprintf(stderr, "WARNING: No spectrum while hopping, ignoring -O and -S.\n");
+		occupancy_base = NULL;
+		stream_port = 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &startup_begin);
+	if(pthread_create(&startup_thread, NULL, startup_sdr, NULL) != 0)
 		return 1;
 
 	int done;
@@ -363,6 +872,7 @@ int main(int argc, char **argv)
 		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Unable to initialize SDL: %s\n", SDL_GetError());
 		exit(1);
 	}
+	log_startup_phase("SDL initialized");
 
 	window = SDL_CreateWindow( "RTL DEMO", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 1366, 768, SDL_WINDOW_OPENGL );
 	if ( !window ) {
@@ -370,6 +880,7 @@ int main(int argc, char **argv)
 		SDL_Quit();
 		exit(2);
 	}
+	log_startup_phase("window created");
 
 	if ( !SDL_GL_CreateContext(window)) {
 		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Unable to create OpenGL context: %s\n", SDL_GetError());
@@ -381,7 +892,16 @@ int main(int argc, char **argv)
 	SDL_GL_SetSwapInterval(1);
 	GLenum err = glewInit();
 	InitGL(1366, 768);
+	log_startup_phase("GL ready");
+
+	pthread_join(startup_thread, NULL);
+	if(startup_result < 0)
+	{
+		SDL_Quit();
+		return 1;
+	}
 	done = 0;
+	bool first_frame = true;
 	
 	SDL_GL_SetSwapInterval(1);
 	while ( ! done ) {
@@ -389,20 +909,38 @@ int main(int argc, char **argv)
 		r = check_events();
 		if(r == 1)
 			done = 1;
-		r = rtl_read_buffer();
+		if(hop_file == NULL)
+			display_take_row();
 
 		random_color_keys();
 		random_rotation_control();
 		random_zoom_control();
 
-		if(delta_freq != 0)
+		/* while hopping the acquisition thread owns the tuner */
+		if(delta_freq != 0 && hop_file == NULL)
 		{
 			curr_freq += delta_freq;
 			char cbufff[42];
 			SDL_snprintf(cbufff,42,"Current frequency %d Hz\n", curr_freq);
-			rtlsdr_set_center_freq(dev,curr_freq);	
+			__atomic_store_n(&requested_freq, curr_freq, __ATOMIC_RELAXED);
 			SDL_Log(cbufff);
 		}
-		DrawGLScene(window, texture, texcoords, fzoom, zzoom);
+		if(hop_file != NULL)
+			DrawHopBars(window);
+		else
+			DrawGLScene(window, texture, texcoords, fzoom, zzoom);
+		if(first_frame)
+		{
+			log_startup_phase("first pixels");
+			first_frame = false;
+		}
 	}
+	stop_acquisition();
+	if(latency_rows > 0)
+		fprintf(stderr, "Capture to display latency: %0.1f ms average, %0.1f ms max over %llu rows.\n",
+			latency_sum / 1e6 / latency_rows, latency_max / 1e6, (unsigned long long)latency_rows);
+	rtlsdr_close(dev);
+	block_pool_free(&sample_pool);
+	SDL_Quit();
+	return 0;
 }
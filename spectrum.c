@@ -0,0 +1,362 @@
+/* batched spectral engine
+ * the engine thread converts samples, fills frame slots and submits
+ * them a batch at a time.  workers mark slots done in any order, the
+ * engine thread delivers them by sequence number so sinks always see
+ * rows in capture order. */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+
+#include "spectrum.h"
+
+#define SLOT_FREE		0
+#define SLOT_QUEUED		1
+#define SLOT_DONE		2
+/* losses are reported at most this often while running */
+#define REPORT_NS		1000000000LL
+
+static float sample_table[256];
+
+static void deliver(struct spectrum_engine *e);
+
+static void run_batch(void *arg)
+{
+	struct spectrum_batch *b = (struct spectrum_batch*)arg;
+	struct spectrum_engine *e = b->engine;
+	struct spectrum_slot *s;
+	int i;
+	for (i = 0; i < SPECTRUM_BATCH; i++) {
+		s = &e->slots[b->first + i];
+		if (e->fixed_point) {
+			s->exponent = fixed_fft_power(&e->fixed_plan, s->iq, s->re16, s->im16, s->power32);
+		} else {
+			fft_power(&e->plan, s->re, s->im, s->power);}
+		__atomic_store_n(&s->state, SLOT_DONE, __ATOMIC_RELEASE);
+	}
+}
+
+static void emit_frame(struct spectrum_engine *e, uint32_t pos)
+/* pos is the newest sample's offset in the current block */
+{
+	uint32_t idx = (uint32_t)(e->next_in % SPECTRUM_SLOTS);
+	uint32_t n = e->fft_size;
+	uint32_t tail = n - e->hist_pos;
+	uint32_t rate = __atomic_load_n(&e->samp_rate, __ATOMIC_RELAXED);
+	struct spectrum_slot *s;
+	if (idx % SPECTRUM_BATCH == 0) {
+		/* slots are freed in order, so the last one of a batch
+		 * being free means the workers kept up.  one block can
+		 * hold more frames than there are slots, so rather than
+		 * drop, deliver what is done and wait for the workers.
+		 * falling behind then shows up as blocks lost from the
+		 * engine's queue. */
+		s = &e->slots[idx + SPECTRUM_BATCH - 1];
+		while (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != SLOT_FREE) {
+			deliver(e);
+			if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) == SLOT_FREE) {
+				break;}
+			if (!__atomic_load_n(&e->running, __ATOMIC_ACQUIRE)) {
+				e->dropped_frames++;
+				return;
+			}
+			e->slot_waits++;
+			sched_yield();
+		}
+	}
+	s = &e->slots[idx];
+	/* oldest sample first */
+	if (e->fixed_point) {
+		memcpy(s->iq, e->hist_iq + 2 * e->hist_pos, 2 * tail);
+		memcpy(s->iq + 2 * tail, e->hist_iq, 2 * e->hist_pos);
+	} else {
+		memcpy(s->re, e->hist_re + e->hist_pos, tail * sizeof(float));
+		memcpy(s->re + tail, e->hist_re, e->hist_pos * sizeof(float));
+		memcpy(s->im, e->hist_im + e->hist_pos, tail * sizeof(float));
+		memcpy(s->im + tail, e->hist_im, e->hist_pos * sizeof(float));
+	}
+	s->meta = *e->meta;
+	s->meta.sample += pos;
+	if (rate) {
+		s->meta.capture_ns += (int64_t)pos * 1000000000 / rate;}
+	s->state = SLOT_QUEUED;
+	e->next_in++;
+	if (idx % SPECTRUM_BATCH == SPECTRUM_BATCH - 1) {
+		if (work_pool_submit(&e->workers, run_batch, &e->batches[idx / SPECTRUM_BATCH]) < 0) {
+			run_batch(&e->batches[idx / SPECTRUM_BATCH]);}
+	}
+}
+
+static void consume_block(struct spectrum_engine *e, const uint8_t *buf, uint32_t len)
+{
+	uint32_t i, mask = e->fft_size - 1;
+	for (i = 0; i + 1 < len; i += 2) {
+		if (e->fixed_point) {
+			e->hist_iq[2 * e->hist_pos] = buf[i];
+			e->hist_iq[2 * e->hist_pos + 1] = buf[i+1];
+		} else {
+			e->hist_re[e->hist_pos] = sample_table[buf[i]];
+			e->hist_im[e->hist_pos] = sample_table[buf[i+1]];
+		}
+		e->hist_pos = (e->hist_pos + 1) & mask;
+		if (e->hist_fill < e->fft_size) {
+			e->hist_fill++;}
+		e->since_frame++;
+		if (e->hist_fill == e->fft_size && e->since_frame >= e->hop) {
+			e->since_frame = 0;
+			emit_frame(e, i / 2);
+		}
+	}
+}
+
+static void emit_row(struct spectrum_engine *e)
+{
+	struct spectrum_row row;
+	uint32_t k, n = e->fft_size;
+	float inv = 1.0f / e->acc_count;
+	int i;
+	/* move DC to the middle of the row */
+	if (e->fixed_point) {
+		for (k = 0; k < n; k++) {
+			e->row_db[k] = fixed_log_power(e->acc64[(k + n / 2) & (n - 1)] / e->acc_count)
+				/ 256.0f + e->fixed_plan.offset_db;
+		}
+		memset(e->acc64, 0, n * sizeof(uint64_t));
+	} else {
+		for (k = 0; k < n; k++) {
+			e->row_db[k] = 10.0f * log10f(e->acc[(k + n / 2) & (n - 1)] * inv + 1e-20f);}
+		memset(e->acc, 0, n * sizeof(float));
+	}
+	row.seq = e->rows++;
+	row.bins = n;
+	row.db = e->row_db;
+	row.frames = e->acc_count;
+	row.center_freq = e->row_meta.center_freq;
+	row.samp_rate = __atomic_load_n(&e->samp_rate, __ATOMIC_RELAXED);
+	row.gain = e->row_meta.gain;
+	row.capture_ns = e->row_meta.capture_ns;
+	row.sample = e->row_meta.sample;
+	e->acc_count = 0;
+	for (i = 0; i < e->sink_count; i++) {
+		e->sinks[i](e->sink_ctx[i], &row);}
+}
+
+static void deliver(struct spectrum_engine *e)
+{
+	struct spectrum_slot *s;
+	uint32_t k;
+	while (e->next_out < e->next_in) {
+		s = &e->slots[e->next_out % SPECTRUM_SLOTS];
+		if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != SLOT_DONE) {
+			break;}
+		/* close the row early rather than mix two tunings */
+		if (e->acc_count && s->meta.center_freq != e->row_meta.center_freq) {
+			emit_row(e);}
+		if (e->fixed_point) {
+			for (k = 0; k < e->fft_size; k++) {
+				e->acc64[k] += (uint64_t)s->power32[k] << (2 * s->exponent);}
+		} else {
+			for (k = 0; k < e->fft_size; k++) {
+				e->acc[k] += s->power[k];}
+		}
+		e->acc_count++;
+		e->row_meta = s->meta;
+		__atomic_store_n(&s->state, SLOT_FREE, __ATOMIC_RELEASE);
+		e->next_out++;
+		if (e->acc_count >= e->average) {
+			emit_row(e);}
+	}
+}
+
+static void report_losses(struct spectrum_engine *e)
+{
+	int64_t now = block_clock_ns();
+	uint64_t gaps = e->sequence.gaps - e->reported_gaps;
+	uint64_t lost = e->sequence.lost - e->reported_lost;
+	uint64_t dropped = e->dropped_frames - e->reported_dropped;
+	if (now - e->reported_ns < REPORT_NS) {
+		return;}
+	if (gaps || dropped) {
+		fprintf(stderr, "Spectrum: %llu gaps losing %llu samples, %llu frames dropped in the last %0.1f s.\n",
+			(unsigned long long)gaps, (unsigned long long)lost, (unsigned long long)dropped,
+			(now - e->reported_ns) / 1e9);
+	}
+	e->reported_ns = now;
+	e->reported_gaps = e->sequence.gaps;
+	e->reported_lost = e->sequence.lost;
+	e->reported_dropped = e->dropped_frames;
+}
+
+static void *engine_loop(void *arg)
+{
+	struct spectrum_engine *e = (struct spectrum_engine*)arg;
+	struct pool_block *block;
+	struct timespec idle = {0, 500000};
+	while (__atomic_load_n(&e->running, __ATOMIC_ACQUIRE)) {
+		block = block_pool_pop(e->pool, e->sub);
+		if (!block) {
+			deliver(e);
+			nanosleep(&idle, NULL);
+			continue;
+		}
+		if (block_sequence_check(&e->sequence, block)) {
+			/* start framing afresh after a gap or a retune */
+			e->hist_fill = 0;
+			e->since_frame = 0;
+		}
+		e->meta = &block->meta;
+		consume_block(e, block->data, block->len);
+		block_pool_release(e->pool, block);
+		deliver(e);
+		report_losses(e);
+	}
+	while ((block = block_pool_pop(e->pool, e->sub)) != NULL) {
+		block_pool_release(e->pool, block);}
+	return NULL;
+}
+
+static int alloc_slot(struct spectrum_slot *s, uint32_t n, int fixed_point)
+{
+	if (fixed_point) {
+		s->iq = (uint8_t*)malloc(2 * n);
+		s->re16 = (int16_t*)malloc(n * sizeof(int16_t));
+		s->im16 = (int16_t*)malloc(n * sizeof(int16_t));
+		s->power32 = (uint32_t*)malloc(n * sizeof(uint32_t));
+		return s->iq && s->re16 && s->im16 && s->power32 ? 0 : -1;
+	}
+	s->re = (float*)malloc(n * sizeof(float));
+	s->im = (float*)malloc(n * sizeof(float));
+	s->power = (float*)malloc(n * sizeof(float));
+	return s->re && s->im && s->power ? 0 : -1;
+}
+
+static void free_slot(struct spectrum_slot *s)
+{
+	free(s->re);
+	free(s->im);
+	free(s->power);
+	free(s->iq);
+	free(s->re16);
+	free(s->im16);
+	free(s->power32);
+}
+
+int spectrum_init(struct spectrum_engine *e, struct block_pool *pool, uint32_t fft_size,
+	double overlap, uint32_t average, int threads, int fixed_point)
+{
+	int i;
+	memset(e, 0, sizeof(struct spectrum_engine));
+	if (overlap < 0.0 || overlap > 0.9) {
+		fprintf(stderr, "Overlap must be between 0 and 90%%.\n");
+		return -1;
+	}
+	e->fixed_point = fixed_point;
+	if (fixed_point) {
+		i = fixed_fft_plan_init(&e->fixed_plan, fft_size);
+	} else {
+		i = fft_plan_init(&e->plan, fft_size);}
+	if (i < 0) {
+		fprintf(stderr, "FFT size must be a power of two.\n");
+		return -1;
+	}
+	for (i = 0; i < 256; i++) {
+		sample_table[i] = (i - 127.4f) / 128.0f;}
+	e->pool = pool;
+	e->fft_size = fft_size;
+	e->hop = (uint32_t)(fft_size * (1.0 - overlap));
+	if (e->hop < 1) {
+		e->hop = 1;}
+	e->average = average > 0 ? average : 1;
+	if (fixed_point) {
+		e->hist_iq = (uint8_t*)calloc(fft_size, 2);
+		e->acc64 = (uint64_t*)calloc(fft_size, sizeof(uint64_t));
+		if (!e->hist_iq || !e->acc64) {
+			return -1;}
+	} else {
+		e->hist_re = (float*)calloc(fft_size, sizeof(float));
+		e->hist_im = (float*)calloc(fft_size, sizeof(float));
+		e->acc = (float*)calloc(fft_size, sizeof(float));
+		if (!e->hist_re || !e->hist_im || !e->acc) {
+			return -1;}
+	}
+	e->row_db = (float*)calloc(fft_size, sizeof(float));
+	if (!e->row_db) {
+		return -1;}
+	for (i = 0; i < SPECTRUM_SLOTS; i++) {
+		if (alloc_slot(&e->slots[i], fft_size, fixed_point) < 0) {
+			return -1;}
+	}
+	for (i = 0; i < SPECTRUM_SLOTS / SPECTRUM_BATCH; i++) {
+		e->batches[i].engine = e;
+		e->batches[i].first = i * SPECTRUM_BATCH;
+	}
+	if (work_pool_init(&e->workers, threads, SPECTRUM_SLOTS / SPECTRUM_BATCH) < 0) {
+		return -1;}
+	e->sub = block_pool_subscribe(pool, SPECTRUM_QUEUE_DEPTH);
+	if (e->sub < 0) {
+		return -1;}
+	fprintf(stderr, "Spectrum: %u point %s FFT, hop %u, %u frames per row.\n",
+		fft_size, fixed_point ? "fixed point" : "float", e->hop, e->average);
+	return 0;
+}
+
+int spectrum_add_sink(struct spectrum_engine *e, spectrum_sink fn, void *ctx)
+{
+	if (e->sink_count >= SPECTRUM_MAX_SINKS) {
+		return -1;}
+	e->sinks[e->sink_count] = fn;
+	e->sink_ctx[e->sink_count] = ctx;
+	e->sink_count++;
+	return 0;
+}
+
+void spectrum_set_rate(struct spectrum_engine *e, uint32_t samp_rate)
+{
+	__atomic_store_n(&e->samp_rate, samp_rate, __ATOMIC_RELAXED);
+}
+
+int spectrum_start(struct spectrum_engine *e)
+{
+	e->reported_ns = block_clock_ns();
+	__atomic_store_n(&e->running, 1, __ATOMIC_RELEASE);
+	if (pthread_create(&e->thread, NULL, engine_loop, e) != 0) {
+		e->running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+void spectrum_stop(struct spectrum_engine *e)
+{
+	int i;
+	if (e->running) {
+		__atomic_store_n(&e->running, 0, __ATOMIC_RELEASE);
+		pthread_join(e->thread, NULL);
+	}
+	work_pool_free(&e->workers);
+	fprintf(stderr, "Spectrum: %llu frames, %llu rows, %llu frames dropped, waited for a slot %llu times.\n",
+		(unsigned long long)e->next_out, (unsigned long long)e->rows,
+		(unsigned long long)e->dropped_frames, (unsigned long long)e->slot_waits);
+	if (e->sequence.gaps || e->sequence.retunes) {
+		fprintf(stderr, "Spectrum: %llu gaps losing %llu samples, %llu retunes.\n",
+			(unsigned long long)e->sequence.gaps, (unsigned long long)e->sequence.lost,
+			(unsigned long long)e->sequence.retunes);
+	}
+	for (i = 0; i < SPECTRUM_SLOTS; i++) {
+		free_slot(&e->slots[i]);}
+	free(e->hist_re);
+	free(e->hist_im);
+	free(e->hist_iq);
+	free(e->acc);
+	free(e->acc64);
+	free(e->row_db);
+	if (e->fixed_point) {
+		fixed_fft_plan_free(&e->fixed_plan);
+	} else {
+		fft_plan_free(&e->plan);}
+}
+
+// vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
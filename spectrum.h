@@ -0,0 +1,170 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+/* batched spectral engine.  cuts the sample stream into overlapping
+ * frames, spreads batches of FFTs over a work stealing pool and
+ * hands averaged rows to its sinks strictly in capture order.  a
+ * frame never spans a gap or a retune and a row never averages
+ * frames from two tunings, each row carries the capture record of
+ * its newest sample. */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "block_pool.h"
+#include "work_pool.h"
+#include "fft.h"
+#include "fixed_fft.h"
+
+/* blocks the engine may lag by while its workers catch up */
+#define SPECTRUM_QUEUE_DEPTH	16
+#define SPECTRUM_SLOTS		64
+#define SPECTRUM_BATCH		4
+#define SPECTRUM_MAX_SINKS	4
+
+struct spectrum_row
+{
+	uint64_t seq;
+	uint32_t bins;
+	/* dB relative to a full scale tone, lowest frequency first */
+	const float *db;
+	uint32_t frames;
+	/* tuning the row was taken at */
+	uint64_t center_freq;
+	uint32_t samp_rate;
+	int32_t gain;
+	/* capture time and device sample index of the newest sample */
+	int64_t capture_ns;
+	uint64_t sample;
+};
+
+typedef void (*spectrum_sink)(void *ctx, const struct spectrum_row *row);
+
+struct spectrum_slot
+{
+	/* float path */
+	float *re;
+	float *im;
+	float *power;
+	/* fixed point path */
+	uint8_t *iq;
+	int16_t *re16;
+	int16_t *im16;
+	uint32_t *power32;
+	int exponent;
+	int state;
+	/* capture record of the frame's newest sample */
+	struct block_meta meta;
+};
+
+struct spectrum_batch
+{
+	struct spectrum_engine *engine;
+	uint32_t first;
+};
+
+struct spectrum_engine
+{
+	struct block_pool *pool;
+	int sub;
+	struct work_pool workers;
+	struct fft_plan plan;
+	struct fixed_fft_plan fixed_plan;
+	int fixed_point;
+	uint32_t fft_size;
+	uint32_t samp_rate;
+	uint32_t hop;
+	uint32_t average;
+	/* last fft_size samples, circular, converted on the float path
+	 * and left as raw IQ on the fixed point path */
+	float *hist_re;
+	float *hist_im;
+	uint8_t *hist_iq;
+	uint32_t hist_pos;
+	uint32_t hist_fill;
+	uint32_t since_frame;
+	/* continuity of the input and the block being framed */
+	struct block_sequence sequence;
+	const struct block_meta *meta;
+	struct spectrum_slot slots[SPECTRUM_SLOTS];
+	struct spectrum_batch batches[SPECTRUM_SLOTS / SPECTRUM_BATCH];
+	uint64_t next_in;
+	uint64_t next_out;
+	/* averaging of delivered frames into rows */
+	float *acc;
+	uint64_t *acc64;
+	float *row_db;
+	struct block_meta row_meta;
+	uint32_t acc_count;
+	uint64_t rows;
+	uint64_t dropped_frames;
+	uint64_t slot_waits;
+	/* totals at the last loss report */
+	int64_t reported_ns;
+	uint64_t reported_gaps;
+	uint64_t reported_lost;
+	uint64_t reported_dropped;
+	spectrum_sink sinks[SPECTRUM_MAX_SINKS];
+	void *sink_ctx[SPECTRUM_MAX_SINKS];
+	int sink_count;
+	int running;
+	pthread_t thread;
+};
+
+/*!
+ * Build the FFT plan, frame slots and worker pool, and subscribe to
+ * the sample pool.  call before acquisition starts.
+ *
+ * \param e the engine to initialize
+ * \param pool the sample pool
+ * \param fft_size bins per transform, a power of two
+ * \param overlap fraction of each frame shared with the next, 0 to 0.9
+ * \param average frames averaged into each output row
+ * \param threads workers, 0 means one per core
+ * \param fixed_point 1 runs the int16 path of fixed_fft.h instead of float
+ * \return 0 on success
+ */
+
+int spectrum_init(struct spectrum_engine *e, struct block_pool *pool, uint32_t fft_size,
+	double overlap, uint32_t average, int threads, int fixed_point);
+
+/*!
+ * Register a consumer of averaged rows, call before spectrum_start().
+ * sinks run on the engine thread in order and must not keep the row.
+ *
+ * \param e the engine given to spectrum_init()
+ * \param fn called once per row
+ * \param ctx handed to fn
+ * \return 0 on success
+ */
+
+int spectrum_add_sink(struct spectrum_engine *e, spectrum_sink fn, void *ctx);
+
+/*!
+ * Record the sample rate rows should be tagged with, any thread.
+ * the centre frequency comes with each block.
+ *
+ * \param e the engine given to spectrum_init()
+ * \param samp_rate in samples/second
+ */
+
+void spectrum_set_rate(struct spectrum_engine *e, uint32_t samp_rate);
+
+/*!
+ * Start the framing thread
+ *
+ * \param e the engine given to spectrum_init()
+ * \return 0 on success
+ */
+
+int spectrum_start(struct spectrum_engine *e);
+
+/*!
+ * Stop the engine and free everything it allocated
+ *
+ * \param e the engine given to spectrum_init()
+ */
+
+void spectrum_stop(struct spectrum_engine *e);
+
+#endif
@@ -0,0 +1,713 @@
+/* spectrum streaming server, see stream_server.h for the protocol */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "units.h"
+#include "stream_server.h"
+
+#define CLIENT_NEW		0
+#define CLIENT_PLAIN		1
+#define CLIENT_WEBSOCKET	2
+
+#define WS_TEXT			0x1
+#define WS_BINARY		0x2
+#define WS_CLOSE		0x8
+#define WS_PING			0x9
+#define WS_PONG			0xa
+#define WS_GUID			"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void put_le(uint8_t *p, uint64_t v, int bytes)
+{
+	int i;
+	for (i = 0; i < bytes; i++) {
+		p[i] = (uint8_t)(v >> (8 * i));}
+}
+
+static uint64_t get_le(const uint8_t *p, int bytes)
+{
+	uint64_t v = 0;
+	int i;
+	for (i = bytes - 1; i >= 0; i--) {
+		v = (v << 8) | p[i];}
+	return v;
+}
+
+static uint32_t rol(uint32_t x, int n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+
+static void sha1(const uint8_t *msg, uint32_t len, uint8_t *digest)
+/* only for the WebSocket handshake, msg is a short key */
+{
+	uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+	uint32_t w[80], a, b, c, d, e, f, k, t, off;
+	uint8_t buf[192];
+	uint32_t total = ((len + 8) / 64 + 1) * 64;
+	int i;
+	memcpy(buf, msg, len);
+	buf[len] = 0x80;
+	memset(buf + len + 1, 0, total - len - 1);
+	for (i = 0; i < 8; i++) {
+		buf[total - 1 - i] = (uint8_t)(((uint64_t)len * 8) >> (8 * i));}
+	for (off = 0; off < total; off += 64) {
+		for (i = 0; i < 16; i++) {
+			w[i] = (uint32_t)buf[off + 4*i] << 24 | (uint32_t)buf[off + 4*i + 1] << 16
+				| (uint32_t)buf[off + 4*i + 2] << 8 | buf[off + 4*i + 3];
+		}
+		for (i = 16; i < 80; i++) {
+			w[i] = rol(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);}
+		a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+		for (i = 0; i < 80; i++) {
+			if (i < 20) {
+				f = (b & c) | (~b & d);
+				k = 0x5a827999;
+			} else if (i < 40) {
+				f = b ^ c ^ d;
+				k = 0x6ed9eba1;
+			} else if (i < 60) {
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8f1bbcdc;
+			} else {
+				f = b ^ c ^ d;
+				k = 0xca62c1d6;
+			}
+			t = rol(a, 5) + f + e + k + w[i];
+			e = d; d = c; c = rol(b, 30); b = a; a = t;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+	}
+	for (i = 0; i < 20; i++) {
+		digest[i] = (uint8_t)(h[i / 4] >> (24 - 8 * (i % 4)));}
+}
+
+static void base64(const uint8_t *in, int len, char *out)
+{
+	static const char table[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	uint32_t v;
+	int i, o = 0;
+	for (i = 0; i < len; i += 3) {
+		v = (uint32_t)in[i] << 16;
+		if (i + 1 < len) {
+			v |= (uint32_t)in[i+1] << 8;}
+		if (i + 2 < len) {
+			v |= in[i+2];}
+		out[o++] = table[(v >> 18) & 63];
+		out[o++] = table[(v >> 12) & 63];
+		out[o++] = i + 1 < len ? table[(v >> 6) & 63] : '=';
+		out[o++] = i + 2 < len ? table[v & 63] : '=';
+	}
+	out[o] = '\0';
+}
+
+static uint32_t run_length(const uint8_t *d, uint32_t n, uint8_t *out)
+/* literal stretches end where a run of three starts */
+{
+	uint32_t i = 0, o = 0, lit, run;
+	while (i < n) {
+		lit = i;
+		while (i < n && i - lit < 128) {
+			if (i + 2 < n && d[i] == d[i+1] && d[i] == d[i+2]) {
+				break;}
+			i++;
+		}
+		if (i > lit) {
+			out[o++] = (uint8_t)(i - lit - 1);
+			memcpy(out + o, d + lit, i - lit);
+			o += i - lit;
+			continue;
+		}
+		run = 1;
+		while (i + run < n && run < 129 && d[i + run] == d[i]) {
+			run++;}
+		out[o++] = (uint8_t)(126 + run);
+		out[o++] = d[i];
+		i += run;
+	}
+	return o;
+}
+
+static int flush_client(struct stream_client *c)
+{
+	ssize_t n;
+	while (c->out_pos < c->out_len) {
+		n = send(c->fd, c->out + c->out_pos, c->out_len - c->out_pos, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;}
+		if (n <= 0) {
+			return -1;}
+		c->out_pos += n;
+	}
+	c->out_pos = 0;
+	c->out_len = 0;
+	return 0;
+}
+
+static int queue_message(struct stream_client *c, const void *msg, uint32_t len, int opcode)
+/* over WebSocket each message gets its own frame header */
+{
+	uint8_t head[4];
+	uint32_t h = 0;
+	if (c->state == CLIENT_WEBSOCKET) {
+		head[0] = (uint8_t)(0x80 | opcode);
+		if (len < 126) {
+			head[1] = (uint8_t)len;
+			h = 2;
+		} else {
+			head[1] = 126;
+			head[2] = (uint8_t)(len >> 8);
+			head[3] = (uint8_t)len;
+			h = 4;
+		}
+	}
+	if (c->out_pos > 0 && c->out_len + h + len > STREAM_OUT_SIZE) {
+		memmove(c->out, c->out + c->out_pos, c->out_len - c->out_pos);
+		c->out_len -= c->out_pos;
+		c->out_pos = 0;
+	}
+	if (c->out_len + h + len > STREAM_OUT_SIZE) {
+		return -1;}
+	memcpy(c->out + c->out_len, head, h);
+	memcpy(c->out + c->out_len + h, msg, len);
+	c->out_len += h + len;
+	return 0;
+}
+
+static void drop_client(struct stream_client *c)
+{
+	fprintf(stderr, "Stream: %s left after %llu frames, %llu kB, %llu skipped.\n",
+		c->name, (unsigned long long)c->frames, (unsigned long long)(c->bytes / 1024),
+		(unsigned long long)c->skipped);
+	close(c->fd);
+	c->fd = -1;
+}
+
+static void client_command(struct stream_client *c, char *line)
+{
+	char cmd[16], a[32], b[32];
+	double v;
+	int n = sscanf(line, "%15s %31s %31s", cmd, a, b);
+	if (n < 1) {
+		return;}
+	if (strcmp(cmd, "range") == 0 && n == 2 && strcmp(a, "all") == 0) {
+		c->f_low = 0;
+		c->f_high = 0;
+	} else if (strcmp(cmd, "range") == 0 && n == 3) {
+		c->f_low = (uint64_t)atofs(a);
+		c->f_high = (uint64_t)atofs(b);
+	} else if (strcmp(cmd, "bins") == 0 && n >= 2) {
+		v = atof(a);
+		c->bins = v < 16 ? 16 : (v > STREAM_MAX_BINS ? STREAM_MAX_BINS : (uint32_t)v);
+	} else if (strcmp(cmd, "rate") == 0 && n >= 2) {
+		v = atof(a);
+		if (v <= 0.0) {
+			v = STREAM_DEFAULT_RATE;}
+		c->interval = (int64_t)(1e9 / v);
+	} else if (strcmp(cmd, "deadband") == 0 && n >= 2) {
+		v = atof(a);
+		c->deadband = v > 0.0 ? (uint32_t)(v * 2.0 + 0.5) : 0;
+	} else {
+		fprintf(stderr, "Stream: %s sent unknown command %s.\n", c->name, cmd);
+		return;
+	}
+	c->need_key = 1;
+	c->commanded = 1;
+	if (c->state == CLIENT_NEW) {
+		c->state = CLIENT_PLAIN;}
+}
+
+static void command_lines(struct stream_client *c, char *text)
+{
+	char *end;
+	while ((end = strchr(text, '\n')) != NULL) {
+		*end = '\0';
+		if (end > text && end[-1] == '\r') {
+			end[-1] = '\0';}
+		client_command(c, text);
+		text = end + 1;
+	}
+	if (text[0]) {
+		client_command(c, text);}
+}
+
+static void consume_input(struct stream_client *c, uint32_t used)
+{
+	memmove(c->in, c->in + used, c->in_len - used);
+	c->in_len -= used;
+}
+
+static int read_plain(struct stream_client *c)
+{
+	char *end;
+	uint32_t used;
+	c->in[c->in_len] = '\0';
+	end = strrchr(c->in, '\n');
+	if (end == NULL) {
+		/* a line longer than the buffer is not a command */
+		return c->in_len >= STREAM_IN_SIZE - 1 ? -1 : 0;}
+	*end = '\0';
+	used = (uint32_t)(end + 1 - c->in);
+	command_lines(c, c->in);
+	consume_input(c, used);
+	return 0;
+}
+
+static int handshake(struct stream_client *c)
+{
+	char *end, *key, accept[32], reply[192], buf[128];
+	uint8_t digest[20];
+	int n;
+	c->in[c->in_len] = '\0';
+	end = strstr(c->in, "\r\n\r\n");
+	if (end == NULL) {
+		return c->in_len >= STREAM_IN_SIZE - 1 ? -1 : 0;}
+	key = strcasestr(c->in, "\nSec-WebSocket-Key:");
+	if (key == NULL || key > end) {
+		return -1;}
+	key += strlen("\nSec-WebSocket-Key:");
+	while (*key == ' ') {
+		key++;}
+	n = (int)strcspn(key, "\r\n ");
+	if (n == 0 || n > 64) {
+		return -1;}
+	snprintf(buf, sizeof(buf), "%.*s%s", n, key, WS_GUID);
+	sha1((const uint8_t*)buf, strlen(buf), digest);
+	base64(digest, 20, accept);
+	n = snprintf(reply, sizeof(reply), "HTTP/1.1 101 Switching Protocols\r\n"
+		"Upgrade: websocket\r\nConnection: Upgrade\r\n"
+		"Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+	queue_message(c, reply, n, 0);
+	c->state = CLIENT_WEBSOCKET;
+	consume_input(c, (uint32_t)(end + 4 - c->in));
+	return 0;
+}
+
+static int read_websocket(struct stream_client *c)
+/* viewers only send short commands, longer messages are refused */
+{
+	uint8_t *p;
+	char text[STREAM_IN_SIZE];
+	uint32_t pos = 0, avail, h, len, i;
+	int opcode;
+	while ((avail = c->in_len - pos) >= 2) {
+		p = (uint8_t*)c->in + pos;
+		opcode = p[0] & 0x0f;
+		len = p[1] & 0x7f;
+		h = 2;
+		if (!(p[1] & 0x80) || len == 127) {
+			return -1;}
+		if (len == 126) {
+			if (avail < 4) {
+				break;}
+			len = (uint32_t)p[2] << 8 | p[3];
+			h = 4;
+		}
+		h += 4;
+		if (h + len > STREAM_IN_SIZE - 1) {
+			return -1;}
+		if (avail < h + len) {
+			break;}
+		for (i = 0; i < len; i++) {
+			p[h + i] ^= p[h - 4 + (i & 3)];}
+		if (opcode == WS_CLOSE) {
+			return -1;}
+		if (opcode == WS_PING) {
+			queue_message(c, p + h, len, WS_PONG);}
+		if (opcode == WS_TEXT) {
+			memcpy(text, p + h, len);
+			text[len] = '\0';
+			command_lines(c, text);
+		}
+		pos += h + len;
+	}
+	consume_input(c, pos);
+	return 0;
+}
+
+static int read_client(struct stream_client *c)
+{
+	ssize_t n = recv(c->fd, c->in + c->in_len, STREAM_IN_SIZE - 1 - c->in_len, 0);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return 0;}
+	if (n <= 0) {
+		return -1;}
+	c->in_len += n;
+	if (c->state == CLIENT_NEW && memcmp(c->in, "GET ", c->in_len < 4 ? c->in_len : 4) == 0) {
+		/* a browser, or too little yet to tell */
+		if (c->in_len < 4) {
+			return 0;}
+		if (handshake(c) < 0) {
+			return -1;}
+		if (c->state != CLIENT_WEBSOCKET) {
+			return 0;}
+	}
+	if (c->state == CLIENT_WEBSOCKET) {
+		return read_websocket(c);}
+	return read_plain(c);
+}
+
+static void accept_client(struct stream_server *s)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	struct stream_client *c = NULL;
+	int fd, i, one = 1;
+	fd = accept(s->listen_fd, (struct sockaddr*)&addr, &addr_len);
+	if (fd < 0) {
+		return;}
+	for (i = 0; i < STREAM_MAX_CLIENTS; i++) {
+		if (s->clients[i].fd < 0) {
+			c = &s->clients[i];
+			break;
+		}
+	}
+	if (c == NULL) {
+		fprintf(stderr, "Stream: all %d viewer slots taken, refusing %s.\n",
+			STREAM_MAX_CLIENTS, inet_ntoa(addr.sin_addr));
+		close(fd);
+		return;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	memset(c, 0, sizeof(struct stream_client));
+	c->fd = fd;
+	c->bins = STREAM_DEFAULT_BINS;
+	c->interval = (int64_t)(1e9 / STREAM_DEFAULT_RATE);
+	c->need_key = 1;
+	snprintf(c->name, sizeof(c->name), "%s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+	s->served++;
+	fprintf(stderr, "Stream: %s connected.\n", c->name);
+}
+
+static void take_row(struct stream_server *s)
+{
+	char drain[64];
+	uint8_t *t;
+	while (read(s->wake[0], drain, sizeof(drain)) > 0) {}
+	pthread_mutex_lock(&s->lock);
+	s->wake_pending = 0;
+	if (s->latest_bins) {
+		t = s->row;
+		s->row = s->latest;
+		s->latest = t;
+		s->row_bins = s->latest_bins;
+		s->row_seq = s->latest_seq;
+		s->row_center = s->latest_center;
+		s->row_rate = s->latest_rate;
+		s->row_capture = s->latest_capture;
+		s->latest_bins = 0;
+		s->row_fresh = 1;
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+static int send_frame(struct stream_server *s, struct stream_client *c, int64_t now)
+{
+	uint32_t n = s->row_bins, first = 0, last = n, bins, i, a, b, len;
+	int64_t start = (int64_t)s->row_center - s->row_rate / 2, lo, hi;
+	uint8_t peak, *f = s->frame;
+	int key, diff;
+	/* a WebSocket viewer is past CLIENT_NEW from the handshake on,
+	 * but it too waits for its first command */
+	if (!c->commanded || now < c->due) {
+		return 0;}
+	if (c->out_len - c->out_pos > STREAM_OUT_SIZE / 2) {
+		/* deltas are against what was sent, so skipping is safe */
+		c->skipped++;
+		s->skipped++;
+		return 0;
+	}
+	c->due += c->interval;
+	if (c->due < now) {
+		c->due = now;}
+	if (c->f_high > c->f_low && s->row_rate) {
+		lo = ((int64_t)c->f_low - start) * n / s->row_rate;
+		hi = (((int64_t)c->f_high - start) * n + s->row_rate - 1) / s->row_rate;
+		first = lo < 0 ? 0 : (lo > n ? n : (uint32_t)lo);
+		last = hi < first ? first : (hi > n ? n : (uint32_t)hi);
+	}
+	bins = last - first < c->bins ? last - first : c->bins;
+	key = c->need_key || c->since_key >= STREAM_KEY_INTERVAL || bins != c->sent_bins
+		|| first != c->first || last != c->last
+		|| s->row_center != c->center_freq || s->row_rate != c->samp_rate;
+	/* peak hold the window down to the viewer's bins */
+	for (i = 0; i < bins; i++) {
+		a = first + (uint32_t)((uint64_t)i * (last - first) / bins);
+		b = first + (uint32_t)((uint64_t)(i + 1) * (last - first) / bins);
+		peak = s->row[a];
+		for (a++; a < b; a++) {
+			if (s->row[a] > peak) {
+				peak = s->row[a];}
+		}
+		s->squeezed[i] = peak;
+	}
+	/* turn it into the change the viewer applies, tracking the
+	 * viewer's copy so deadband errors never accumulate */
+	for (i = 0; i < bins; i++) {
+		if (key) {
+			c->prev[i] = s->squeezed[i];
+			continue;
+		}
+		diff = (int)s->squeezed[i] - c->prev[i];
+		if (diff <= (int)c->deadband && diff >= -(int)c->deadband) {
+			diff = 0;}
+		c->prev[i] += (uint8_t)diff;
+		s->squeezed[i] = (uint8_t)diff;
+	}
+	len = run_length(s->squeezed, bins, f + STREAM_HEADER_SIZE);
+	f[0] = 'S';
+	f[1] = 'P';
+	f[2] = key ? STREAM_KEY : STREAM_DELTA;
+	f[3] = 0;
+	put_le(f + 4, s->row_seq, 4);
+	put_le(f + 8, bins, 2);
+	put_le(f + 10, 0, 2);
+	put_le(f + 12, len, 4);
+	put_le(f + 16, s->row_rate ? start + (int64_t)first * s->row_rate / n : 0, 8);
+	put_le(f + 24, s->row_rate ? start + (int64_t)last * s->row_rate / n : 0, 8);
+	if (queue_message(c, f, STREAM_HEADER_SIZE + len, WS_BINARY) < 0) {
+		c->skipped++;
+		s->skipped++;
+		c->need_key = 1;
+		return 0;
+	}
+	c->first = first;
+	c->last = last;
+	c->sent_bins = bins;
+	c->center_freq = s->row_center;
+	c->samp_rate = s->row_rate;
+	c->since_key = key ? 0 : c->since_key + 1;
+	c->need_key = 0;
+	c->frames++;
+	c->bytes += STREAM_HEADER_SIZE + len;
+	s->frames++;
+	s->bytes += STREAM_HEADER_SIZE + len;
+	return flush_client(c);
+}
+
+static void *server_loop(void *arg)
+{
+	struct stream_server *s = (struct stream_server*)arg;
+	struct pollfd fds[STREAM_MAX_CLIENTS + 2];
+	int who[STREAM_MAX_CLIENTS + 2];
+	struct stream_client *c;
+	int i, n, drop;
+	uint64_t frames;
+	int64_t now, latency;
+	while (__atomic_load_n(&s->running, __ATOMIC_ACQUIRE)) {
+		fds[0].fd = s->wake[0];
+		fds[0].events = POLLIN;
+		fds[1].fd = s->listen_fd;
+		fds[1].events = POLLIN;
+		n = 2;
+		for (i = 0; i < STREAM_MAX_CLIENTS; i++) {
+			c = &s->clients[i];
+			if (c->fd < 0) {
+				continue;}
+			fds[n].fd = c->fd;
+			fds[n].events = POLLIN | (c->out_len > c->out_pos ? POLLOUT : 0);
+			who[n] = i;
+			n++;
+		}
+		if (poll(fds, n, 100) < 0) {
+			if (errno == EINTR) {
+				continue;}
+			fprintf(stderr, "WARNING: Stream server poll failed.\n");
+			break;
+		}
+		if (fds[0].revents & POLLIN) {
+			take_row(s);}
+		for (i = 2; i < n; i++) {
+			c = &s->clients[who[i]];
+			drop = (fds[i].revents & (POLLERR | POLLNVAL)) != 0;
+			if (!drop && (fds[i].revents & (POLLIN | POLLHUP))) {
+				drop = read_client(c) < 0;}
+			if (!drop && c->out_len > c->out_pos) {
+				drop = flush_client(c) < 0;}
+			if (drop) {
+				drop_client(c);}
+		}
+		if (s->row_fresh) {
+			now = now_ns();
+			frames = s->frames;
+			for (i = 0; i < STREAM_MAX_CLIENTS; i++) {
+				c = &s->clients[i];
+				if (c->fd >= 0 && send_frame(s, c, now) < 0) {
+					drop_client(c);}
+			}
+			if (s->frames != frames && s->row_capture) {
+				latency = now_ns() - s->row_capture;
+				s->latency_rows++;
+				s->latency_sum += latency;
+				if (latency > s->latency_max) {
+					s->latency_max = latency;}
+			}
+			s->row_fresh = 0;
+		}
+		if (fds[1].revents & POLLIN) {
+			accept_client(s);}
+	}
+	return NULL;
+}
+
+int stream_open(struct stream_server *s, int port, uint32_t max_bins)
+{
+	struct sockaddr_in addr;
+	int i, one = 1;
+	memset(s, 0, sizeof(struct stream_server));
+	s->listen_fd = -1;
+	s->max_bins = max_bins;
+	s->latest = (uint8_t*)malloc(max_bins);
+	s->row = (uint8_t*)malloc(max_bins);
+	s->clients = (struct stream_client*)calloc(STREAM_MAX_CLIENTS, sizeof(struct stream_client));
+	if (!s->latest || !s->row || !s->clients) {
+		return -1;}
+	for (i = 0; i < STREAM_MAX_CLIENTS; i++) {
+		s->clients[i].fd = -1;}
+	if (pipe(s->wake) < 0) {
+		return -1;}
+	fcntl(s->wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(s->wake[1], F_SETFL, O_NONBLOCK);
+	s->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (s->listen_fd < 0) {
+		return -1;}
+	setsockopt(s->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons((uint16_t)port);
+	if (bind(s->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+		|| listen(s->listen_fd, 16) < 0) {
+		fprintf(stderr, "Failed to listen on port %d.\n", port);
+		return -1;
+	}
+	fcntl(s->listen_fd, F_SETFL, O_NONBLOCK);
+	pthread_mutex_init(&s->lock, NULL);
+	__atomic_store_n(&s->running, 1, __ATOMIC_RELEASE);
+	if (pthread_create(&s->thread, NULL, server_loop, s) != 0) {
+		s->running = 0;
+		return -1;
+	}
+	fprintf(stderr, "Streaming spectrum on port %d.\n", port);
+	return 0;
+}
+
+void stream_sink(void *ctx, const struct spectrum_row *row)
+{
+	struct stream_server *s = (struct stream_server*)ctx;
+	uint32_t k;
+	float q;
+	char one = 1;
+	if (row->bins > s->max_bins) {
+		return;}
+	pthread_mutex_lock(&s->lock);
+	for (k = 0; k < row->bins; k++) {
+		q = (row->db[k] - STREAM_DB_MIN) * 2.0f;
+		s->latest[k] = q < 0.0f ? 0 : (q > 255.0f ? 255 : (uint8_t)q);
+	}
+	s->latest_bins = row->bins;
+	s->latest_seq = row->seq;
+	s->latest_center = row->center_freq;
+	s->latest_rate = row->samp_rate;
+	s->latest_capture = row->capture_ns;
+	if (!s->wake_pending) {
+		s->wake_pending = 1;
+		if (write(s->wake[1], &one, 1) < 0) {
+			s->wake_pending = 0;}
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+void stream_close(struct stream_server *s)
+{
+	char one = 1;
+	int i;
+	if (s->running) {
+		__atomic_store_n(&s->running, 0, __ATOMIC_RELEASE);
+		if (write(s->wake[1], &one, 1) < 0) {}
+		pthread_join(s->thread, NULL);
+	}
+	for (i = 0; s->clients && i < STREAM_MAX_CLIENTS; i++) {
+		if (s->clients[i].fd >= 0) {
+			drop_client(&s->clients[i]);}
+	}
+	fprintf(stderr, "Stream: %u viewers served, %llu frames, %llu kB sent, %llu frames skipped.\n",
+		s->served, (unsigned long long)s->frames, (unsigned long long)(s->bytes / 1024),
+		(unsigned long long)s->skipped);
+	if (s->latency_rows) {
+		fprintf(stderr, "Stream: capture to send %0.1f ms average, %0.1f ms max.\n",
+			s->latency_sum / 1e6 / s->latency_rows, s->latency_max / 1e6);}
+	if (s->listen_fd >= 0) {
+		close(s->listen_fd);}
+	close(s->wake[0]);
+	close(s->wake[1]);
+	pthread_mutex_destroy(&s->lock);
+	free(s->clients);
+	free(s->latest);
+	free(s->row);
+}
+
+int stream_parse_header(const uint8_t *buf, struct stream_frame *f)
+{
+	if (buf[0] != 'S' || buf[1] != 'P' || buf[2] > STREAM_DELTA) {
+		return -1;}
+	f->type = buf[2];
+	f->seq = (uint32_t)get_le(buf + 4, 4);
+	f->bins = (uint32_t)get_le(buf + 8, 2);
+	f->payload = (uint32_t)get_le(buf + 12, 4);
+	f->f_low = get_le(buf + 16, 8);
+	f->f_high = get_le(buf + 24, 8);
+	if (f->bins > STREAM_MAX_BINS || f->payload > f->bins + f->bins / 128 + 1) {
+		return -1;}
+	return 0;
+}
+
+int stream_decode(const struct stream_frame *f, const uint8_t *payload, uint8_t *row)
+{
+	uint32_t pos = 0, i = 0, n, k;
+	uint8_t c, v;
+	while (pos < f->payload) {
+		c = payload[pos++];
+		if (c < 128) {
+			n = c + 1;
+			if (pos + n > f->payload || i + n > f->bins) {
+				return -1;}
+			for (k = 0; k < n; k++) {
+				row[i+k] = f->type == STREAM_KEY ? payload[pos+k] : row[i+k] + payload[pos+k];}
+			pos += n;
+		} else {
+			n = c - 126;
+			if (c == 128 || pos >= f->payload || i + n > f->bins) {
+				return -1;}
+			v = payload[pos++];
+			for (k = 0; k < n; k++) {
+				row[i+k] = f->type == STREAM_KEY ? v : row[i+k] + v;}
+		}
+		i += n;
+	}
+	return i == f->bins ? 0 : -1;
+}
+
+// vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
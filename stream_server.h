@@ -0,0 +1,195 @@
+#ifndef STREAM_SERVER_H
+#define STREAM_SERVER_H
+
+/* spectrum streaming server.
+ *
+ * spectrum rows are quantized once to 0.5 dB steps and handed to a
+ * server thread that owns every viewer connection.  each viewer picks
+ * its own frequency window, bin count, frame rate and deadband, and
+ * gets the row squeezed (peak hold) to that window, delta coded
+ * against the last row it was sent and run length coded.  a viewer
+ * that cannot keep up simply skips rows, deltas are always against
+ * what it actually received.
+ *
+ * viewers connect over plain TCP or as a WebSocket, the first line
+ * decides.  plain viewers send newline terminated commands, WebSocket
+ * viewers send them as text messages:
+ *
+ *	range <low> <high>	frequency window, "range all" for the full span
+ *	bins <n>		bins per frame, the window is peak held to fit
+ *	rate <fps>		frames per second
+ *	deadband <dB>		changes up to this are sent as no change
+ *
+ * nothing is sent until the first command.  each frame is a
+ * STREAM_HEADER_SIZE byte little endian header followed by the coded
+ * bins, over WebSocket one frame per binary message:
+ *
+ *	0	'S' 'P'
+ *	2	type, STREAM_KEY or STREAM_DELTA
+ *	3	reserved
+ *	4	u32 row sequence number
+ *	8	u16 bins
+ *	10	u16 reserved
+ *	12	u32 payload bytes
+ *	16	u64 frequency of the lower edge of the first bin, Hz
+ *	24	u64 frequency of the upper edge of the last bin, Hz
+ *
+ * the payload codes one byte per bin, the value itself in a key frame
+ * and the change modulo 256 in a delta frame.  control byte c < 128 is
+ * followed by c + 1 literal bytes, c > 128 by one byte repeated
+ * c - 126 times. */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "spectrum.h"
+
+#define STREAM_DEFAULT_PORT	5555
+#define STREAM_MAX_CLIENTS	64
+#define STREAM_MAX_BINS		4096
+#define STREAM_DEFAULT_BINS	1024
+#define STREAM_DEFAULT_RATE	10.0
+#define STREAM_IN_SIZE		2048
+#define STREAM_OUT_SIZE		65536
+/* delta frames between forced key frames */
+#define STREAM_KEY_INTERVAL	256
+#define STREAM_HEADER_SIZE	32
+#define STREAM_KEY		0
+#define STREAM_DELTA		1
+/* value q stands for STREAM_DB_MIN + q/2 dB */
+#define STREAM_DB_MIN		-127.5f
+
+struct stream_client
+{
+	int fd;
+	/* waiting for the first line, plain TCP or WebSocket */
+	int state;
+	/* nothing is sent before the first command */
+	int commanded;
+	char name[32];
+	/* viewer settings, f_high == 0 means the whole span */
+	uint64_t f_low;
+	uint64_t f_high;
+	uint32_t bins;
+	uint32_t deadband;
+	int64_t interval;
+	int64_t due;
+	/* window of the last frame, a change forces a key frame */
+	uint64_t center_freq;
+	uint32_t samp_rate;
+	uint32_t first;
+	uint32_t last;
+	uint32_t sent_bins;
+	uint32_t since_key;
+	int need_key;
+	/* the row as the viewer has reconstructed it */
+	uint8_t prev[STREAM_MAX_BINS];
+	char in[STREAM_IN_SIZE];
+	uint32_t in_len;
+	uint8_t out[STREAM_OUT_SIZE];
+	uint32_t out_pos;
+	uint32_t out_len;
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t skipped;
+};
+
+struct stream_server
+{
+	int listen_fd;
+	/* the sink writes a byte here to wake the server thread */
+	int wake[2];
+	int wake_pending;
+	/* newest quantized row, swapped with row by the server thread */
+	uint8_t *latest;
+	uint8_t *row;
+	uint32_t max_bins;
+	uint32_t latest_bins;
+	uint32_t row_bins;
+	uint64_t latest_seq;
+	uint64_t row_seq;
+	uint64_t latest_center;
+	uint64_t row_center;
+	uint32_t latest_rate;
+	uint32_t row_rate;
+	int64_t latest_capture;
+	int64_t row_capture;
+	int row_fresh;
+	/* per frame scratch, server thread only */
+	uint8_t squeezed[STREAM_MAX_BINS];
+	uint8_t frame[STREAM_HEADER_SIZE + STREAM_MAX_BINS + STREAM_MAX_BINS / 128 + 16];
+	struct stream_client *clients;
+	uint32_t served;
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t skipped;
+	/* capture of a row's newest sample to its first frame going out */
+	uint64_t latency_rows;
+	int64_t latency_sum;
+	int64_t latency_max;
+	int running;
+	pthread_t thread;
+	pthread_mutex_t lock;
+};
+
+/* a parsed frame header */
+struct stream_frame
+{
+	int type;
+	uint32_t seq;
+	uint32_t bins;
+	uint32_t payload;
+	uint64_t f_low;
+	uint64_t f_high;
+};
+
+/*!
+ * Listen for viewers on all interfaces and start the server thread
+ *
+ * \param s the server to initialize
+ * \param port TCP port
+ * \param max_bins largest row the sink will be given, the FFT size
+ * \return 0 on success
+ */
+
+int stream_open(struct stream_server *s, int port, uint32_t max_bins);
+
+/*!
+ * Spectrum sink, pass the server as ctx to spectrum_add_sink()
+ *
+ * \param ctx the server given to stream_open()
+ * \param row an averaged spectrum row
+ */
+
+void stream_sink(void *ctx, const struct spectrum_row *row);
+
+/*!
+ * Disconnect every viewer and stop the server thread
+ *
+ * \param s the server given to stream_open()
+ */
+
+void stream_close(struct stream_server *s);
+
+/*!
+ * Parse a frame header, for viewers
+ *
+ * \param buf STREAM_HEADER_SIZE bytes
+ * \param f filled with the header fields
+ * \return 0 on success, -1 if buf is not a frame header
+ */
+
+int stream_parse_header(const uint8_t *buf, struct stream_frame *f);
+
+/*!
+ * Apply a frame's payload to the viewer's copy of the row
+ *
+ * \param f the parsed header
+ * \param payload f->payload coded bytes
+ * \param row f->bins values, replaced by a key frame, updated by a delta
+ * \return 0 on success, -1 if the payload does not cover exactly f->bins
+ */
+
+int stream_decode(const struct stream_frame *f, const uint8_t *payload, uint8_t *row);
+
+#endif
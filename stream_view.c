@@ -0,0 +1,217 @@
+/* text viewer for the spectrum stream of demo -S, prints rates and an
+ * optional coarse spectrum, enough to check a server over loopback */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "stream_server.h"
+
+#define TEXT_COLUMNS		64
+#define TEXT_DB_MIN		-100.0f
+#define TEXT_DB_RANGE		80.0f
+
+static const char shades[] = " .:-=+*#%@";
+
+void usage(void)
+{
+	fprintf(stderr,
+		"stream_view, text viewer for the demo -S spectrum stream\n\n"
+		"Usage:\tstream_view [-options]\n"
+		"\t[-a host (default: 127.0.0.1)]\n"
+		"\t[-p port (default: 5555)]\n"
+		"\t[-f low_freq -F high_freq (default: whole span)]\n"
+		"\t[-n bins (default: 1024)]\n"
+		"\t[-r frames_per_second (default: 10)]\n"
+		"\t[-D deadband (default: 0 dB)]\n"
+		"\t[-c frames to receive before exiting (default: forever)]\n"
+		"\t[-v print a text spectrum every second]\n");
+	exit(1);
+}
+
+int connect_to(const char *host, const char *port)
+{
+	struct addrinfo hints, *res, *ai;
+	int fd = -1;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &res) != 0) {
+		fprintf(stderr, "Can't resolve %s.\n", host);
+		return -1;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			continue;}
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			break;}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0) {
+		fprintf(stderr, "Can't connect to %s:%s.\n", host, port);}
+	return fd;
+}
+
+void print_spectrum(const struct stream_frame *f, const uint8_t *row)
+{
+	char line[TEXT_COLUMNS + 1];
+	uint32_t i, k, a, b, columns = f->bins < TEXT_COLUMNS ? f->bins : TEXT_COLUMNS;
+	uint8_t peak;
+	float y;
+	for (i = 0; i < columns; i++) {
+		a = i * f->bins / columns;
+		b = (i + 1) * f->bins / columns;
+		peak = row[a];
+		for (k = a + 1; k < b; k++) {
+			if (row[k] > peak) {
+				peak = row[k];}
+		}
+		y = (STREAM_DB_MIN + peak / 2.0f - TEXT_DB_MIN) / TEXT_DB_RANGE;
+		y = y < 0.0f ? 0.0f : (y > 1.0f ? 1.0f : y);
+		line[i] = shades[(int)(y * (sizeof(shades) - 2) + 0.5f)];
+	}
+	line[columns] = '\0';
+	printf("%9.4f |%s| %0.4f MHz\n", f->f_low / 1e6, line, f->f_high / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	/* f is the header being parsed, shown the one of the decoded row */
+	struct stream_frame f, shown;
+	struct timespec now, last;
+	char *host = (char*)"127.0.0.1", port[16], cmd[256];
+	char *f_low = NULL, *f_high = NULL;
+	static uint8_t buf[STREAM_OUT_SIZE], row[STREAM_MAX_BINS];
+	uint32_t len = 0, pos, peak;
+	uint64_t frames = 0, keys = 0, bytes = 0, uncoded = 0, limit = 0, total = 0;
+	uint64_t total_bytes = 0, total_uncoded = 0;
+	int fd, opt, n, verbose = 0, have_row = 0;
+	double bins = STREAM_DEFAULT_BINS, rate = STREAM_DEFAULT_RATE, deadband = 0.0, secs;
+	memset(&f, 0, sizeof(f));
+	memset(&shown, 0, sizeof(shown));
+	snprintf(port, sizeof(port), "%d", STREAM_DEFAULT_PORT);
+	while ((opt = getopt(argc, argv, "a:p:f:F:n:r:D:c:vh")) != -1) {
+		switch (opt) {
+		case 'a':
+			host = optarg;
+			break;
+		case 'p':
+			snprintf(port, sizeof(port), "%s", optarg);
+			break;
+		case 'f':
+			f_low = optarg;
+			break;
+		case 'F':
+			f_high = optarg;
+			break;
+		case 'n':
+			bins = atof(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'D':
+			deadband = atof(optarg);
+			break;
+		case 'c':
+			limit = (uint64_t)atof(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'h':
+		default:
+			usage();
+			break;
+		}
+	}
+	if ((f_low == NULL) != (f_high == NULL)) {
+		usage();}
+
+	fd = connect_to(host, port);
+	if (fd < 0) {
+		return 1;}
+	n = snprintf(cmd, sizeof(cmd), "bins %0.0f\nrate %g\ndeadband %g\nrange %s %s\n",
+		bins, rate, deadband, f_low ? f_low : "all", f_high ? f_high : "");
+	if (send(fd, cmd, n, 0) != n) {
+		fprintf(stderr, "Failed to send settings.\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &last);
+	while (limit == 0 || total < limit) {
+		n = recv(fd, buf + len, sizeof(buf) - len, 0);
+		if (n <= 0) {
+			fprintf(stderr, "Server closed the stream.\n");
+			break;
+		}
+		len += n;
+		pos = 0;
+		while (len - pos >= STREAM_HEADER_SIZE) {
+			if (stream_parse_header(buf + pos, &f) < 0) {
+				fprintf(stderr, "Bad frame header.\n");
+				return 1;
+			}
+			if (len - pos < STREAM_HEADER_SIZE + f.payload) {
+				break;}
+			if (f.type == STREAM_DELTA && !have_row) {
+				fprintf(stderr, "Delta frame before any key frame.\n");
+				return 1;
+			}
+			if (stream_decode(&f, buf + pos + STREAM_HEADER_SIZE, row) < 0) {
+				fprintf(stderr, "Frame %u does not decode.\n", f.seq);
+				return 1;
+			}
+			have_row = 1;
+			shown = f;
+			frames++;
+			total++;
+			keys += f.type == STREAM_KEY;
+			bytes += STREAM_HEADER_SIZE + f.payload;
+			uncoded += STREAM_HEADER_SIZE + f.bins;
+			pos += STREAM_HEADER_SIZE + f.payload;
+		}
+		memmove(buf, buf + pos, len - pos);
+		len -= pos;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		secs = (now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec) / 1e9;
+		if (secs < 1.0 && (limit == 0 || total < limit)) {
+			continue;}
+		printf("%0.1f frames/s (%llu key), %0.1f kB/s, %0.0f bytes/frame, %0.1f %% of uncoded",
+			frames / secs, (unsigned long long)keys, bytes / secs / 1024.0,
+			frames ? (double)bytes / frames : 0.0, uncoded ? 100.0 * bytes / uncoded : 0.0);
+		if (have_row && shown.bins && shown.f_high > shown.f_low) {
+			peak = 0;
+			for (pos = 1; pos < shown.bins; pos++) {
+				if (row[pos] > row[peak]) {
+					peak = pos;}
+			}
+			printf(", peak %0.4f MHz %0.1f dB", (shown.f_low + (peak + 0.5)
+				* (double)(shown.f_high - shown.f_low) / shown.bins) / 1e6, STREAM_DB_MIN + row[peak] / 2.0f);
+		}
+		printf("\n");
+		if (verbose && have_row) {
+			print_spectrum(&shown, row);}
+		fflush(stdout);
+		total_bytes += bytes;
+		total_uncoded += uncoded;
+		frames = keys = bytes = uncoded = 0;
+		last = now;
+	}
+	if (limit) {
+		printf("%llu frames, %llu bytes, %0.1f %% of uncoded\n", (unsigned long long)total,
+			(unsigned long long)total_bytes, total_uncoded ? 100.0 * total_bytes / total_uncoded : 0.0);}
+	close(fd);
+	return 0;
+}
+
+// vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
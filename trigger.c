@@ -0,0 +1,245 @@
+/* energy triggered burst capture
+ * the trigger thread reads its own pool queue so a slow disk only
+ * ever costs the trigger its blocks, never the acquisition thread. */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "trigger.h"
+
+#define TRIGGER_IDLE		0
+#define TRIGGER_POST		1
+#define TRIGGER_WRITING		2
+
+static void ring_append(struct burst_trigger *t, const uint8_t *buf, size_t len)
+{
+	size_t n;
+	if (len >= t->ring_len) {
+		memcpy(t->ring, buf + len - t->ring_len, t->ring_len);
+		t->ring_pos = 0;
+		t->ring_fill = t->ring_len;
+		return;
+	}
+	n = t->ring_len - t->ring_pos;
+	if (n > len) {
+		n = len;}
+	memcpy(t->ring + t->ring_pos, buf, n);
+	memcpy(t->ring, buf + n, len - n);
+	t->ring_pos = (t->ring_pos + len) % t->ring_len;
+	t->ring_fill += len;
+	if (t->ring_fill > t->ring_len) {
+		t->ring_fill = t->ring_len;}
+}
+
+static void ring_unroll(struct burst_trigger *t)
+/* copy the pre-trigger window, oldest sample first */
+{
+	size_t start = (t->ring_pos + t->ring_len - t->ring_fill) % t->ring_len;
+	size_t n = t->ring_len - start;
+	if (n > t->ring_fill) {
+		n = t->ring_fill;}
+	memcpy(t->burst, t->ring + start, n);
+	memcpy(t->burst + n, t->ring, t->ring_fill - n);
+	t->burst_len = t->ring_fill;
+}
+
+static void hand_to_writer(struct burst_trigger *t)
+{
+	pthread_mutex_lock(&t->lock);
+	__atomic_store_n(&t->state, TRIGGER_WRITING, __ATOMIC_RELEASE);
+	pthread_cond_signal(&t->ready);
+	pthread_mutex_unlock(&t->lock);
+}
+
+static void trigger_block(struct burst_trigger *t, const struct pool_block *block)
+{
+	const uint8_t *buf = block->data;
+	uint32_t len = block->len;
+	size_t n;
+	int state = __atomic_load_n(&t->state, __ATOMIC_ACQUIRE);
+	if (block_sequence_check(&t->sequence, block)) {
+		if (state == TRIGGER_POST) {
+			t->burst_gaps++;}
+		/* history before a discontinuity is not worth keeping */
+		t->ring_fill = 0;
+	}
+	if (state == TRIGGER_POST) {
+		n = t->burst_cap - t->burst_len;
+		if (n > len) {
+			n = len;}
+		memcpy(t->burst + t->burst_len, buf, n);
+		t->burst_len += n;
+		if (t->burst_len >= t->burst_cap) {
+			hand_to_writer(t);}
+	}
+	ring_append(t, buf, len);
+	if (state == TRIGGER_POST) {
+		return;}
+	if (block_energy(buf, len) <= t->threshold) {
+		return;}
+	if (state == TRIGGER_WRITING) {
+		/* the previous burst is still going to disk */
+		t->missed++;
+		return;
+	}
+	t->fired++;
+	t->burst_time = time(NULL);
+	ring_unroll(t);
+	/* the window ends with this block, work back to its start */
+	t->burst_meta = block->meta;
+	t->burst_meta.sample = block->meta.sample + len / 2 - t->burst_len / 2;
+	t->burst_meta.capture_ns -= ((int64_t)(t->burst_len / 2) - len / 2) * 1000000000 / t->samp_rate;
+	t->burst_gaps = 0;
+	fprintf(stderr, "Trigger fired, capturing burst %u.\n", t->fired);
+	if (t->post_len == 0) {
+		hand_to_writer(t);
+		return;
+	}
+	__atomic_store_n(&t->state, TRIGGER_POST, __ATOMIC_RELEASE);
+}
+
+static void write_burst(struct burst_trigger *t)
+{
+	char name[64], stamp[32];
+	FILE *f;
+	strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", localtime(&t->burst_time));
+	snprintf(name, sizeof(name), "burst_%s_%u.cu8", stamp, t->fired);
+	f = fopen(name, "wb");
+	if (!f) {
+		fprintf(stderr, "WARNING: Failed to open %s.\n", name);
+		return;
+	}
+	if (fwrite(t->burst, 1, t->burst_len, f) != t->burst_len) {
+		fprintf(stderr, "WARNING: Short write to %s.\n", name);
+	} else {
+		fprintf(stderr, "Wrote %zu bytes to %s.\n", t->burst_len, name);}
+	fclose(f);
+	snprintf(name, sizeof(name), "burst_%s_%u.txt", stamp, t->fired);
+	f = fopen(name, "w");
+	if (!f) {
+		fprintf(stderr, "WARNING: Failed to open %s.\n", name);
+		return;
+	}
+	fprintf(f, "sample %llu\ncapture_ns %lld\ncenter_freq %llu\nsamp_rate %u\n",
+		(unsigned long long)t->burst_meta.sample, (long long)t->burst_meta.capture_ns,
+		(unsigned long long)t->burst_meta.center_freq, t->samp_rate);
+	if (t->burst_meta.gain == BLOCK_GAIN_AUTO) {
+		fprintf(f, "gain auto\n");
+	} else {
+		fprintf(f, "gain %0.1f\n", t->burst_meta.gain / 10.0);}
+	fprintf(f, "gaps %u\n", t->burst_gaps);
+	fclose(f);
+}
+
+static void *writer_loop(void *arg)
+{
+	struct burst_trigger *t = (struct burst_trigger*)arg;
+	for (;;) {
+		pthread_mutex_lock(&t->lock);
+		while (__atomic_load_n(&t->running, __ATOMIC_ACQUIRE) && __atomic_load_n(&t->state, __ATOMIC_ACQUIRE) != TRIGGER_WRITING) {
+			pthread_cond_wait(&t->ready, &t->lock);}
+		if (__atomic_load_n(&t->state, __ATOMIC_ACQUIRE) != TRIGGER_WRITING) {
+			pthread_mutex_unlock(&t->lock);
+			break;
+		}
+		pthread_mutex_unlock(&t->lock);
+		write_burst(t);
+		__atomic_store_n(&t->state, TRIGGER_IDLE, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void *trigger_loop(void *arg)
+{
+	struct burst_trigger *t = (struct burst_trigger*)arg;
+	struct pool_block *block;
+	struct timespec idle = {0, 1000000};
+	while (__atomic_load_n(&t->running, __ATOMIC_ACQUIRE)) {
+		block = block_pool_pop(t->pool, t->sub);
+		if (!block) {
+			nanosleep(&idle, NULL);
+			continue;
+		}
+		trigger_block(t, block);
+		block_pool_release(t->pool, block);
+	}
+	while ((block = block_pool_pop(t->pool, t->sub)) != NULL) {
+		block_pool_release(t->pool, block);}
+	/* keep whatever part of the post window was captured */
+	if (t->state == TRIGGER_POST) {
+		hand_to_writer(t);}
+	return NULL;
+}
+
+int trigger_init(struct burst_trigger *t, struct block_pool *pool, uint32_t samp_rate,
+	double threshold_db, double pre_seconds, double post_seconds)
+{
+	memset(t, 0, sizeof(struct burst_trigger));
+	t->pool = pool;
+	t->samp_rate = samp_rate;
+	t->threshold = (uint32_t)(32768.0 * pow(10.0, threshold_db / 10.0));
+	/* whole IQ pairs, at least one block of history */
+	t->ring_len = (size_t)(pre_seconds * samp_rate) * 2;
+	if (t->ring_len < pool->block_size) {
+		t->ring_len = pool->block_size;}
+	t->post_len = (size_t)(post_seconds * samp_rate) * 2;
+	t->burst_cap = t->ring_len + t->post_len;
+	t->ring = (uint8_t*)malloc(t->ring_len);
+	t->burst = (uint8_t*)malloc(t->burst_cap);
+	if (!t->ring || !t->burst) {
+		fprintf(stderr, "Failed to allocate trigger windows.\n");
+		free(t->ring);
+		free(t->burst);
+		return -1;
+	}
+	t->sub = block_pool_subscribe(pool, TRIGGER_QUEUE_DEPTH);
+	if (t->sub < 0) {
+		free(t->ring);
+		free(t->burst);
+		return -1;
+	}
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_cond_init(&t->ready, NULL);
+	fprintf(stderr, "Trigger at %0.1f dBFS, %0.1f s before, %0.1f s after.\n",
+		threshold_db, pre_seconds, post_seconds);
+	return 0;
+}
+
+int trigger_start(struct burst_trigger *t)
+{
+	__atomic_store_n(&t->running, 1, __ATOMIC_RELEASE);
+	if (pthread_create(&t->writer, NULL, writer_loop, t) != 0) {
+		t->running = 0;
+		return -1;
+	}
+	if (pthread_create(&t->thread, NULL, trigger_loop, t) != 0) {
+		trigger_stop(t);
+		return -1;
+	}
+	return 0;
+}
+
+void trigger_stop(struct burst_trigger *t)
+{
+	if (t->running) {
+		__atomic_store_n(&t->running, 0, __ATOMIC_RELEASE);
+		if (t->thread) {
+			pthread_join(t->thread, NULL);}
+		pthread_mutex_lock(&t->lock);
+		pthread_cond_signal(&t->ready);
+		pthread_mutex_unlock(&t->lock);
+		pthread_join(t->writer, NULL);
+	}
+	if (t->fired || t->missed) {
+		fprintf(stderr, "Trigger fired %u times, missed %u while writing.\n",
+			t->fired, t->missed);}
+	free(t->ring);
+	free(t->burst);
+	t->ring = NULL;
+	t->burst = NULL;
+}
+
+// vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
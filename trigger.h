@@ -0,0 +1,87 @@
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+/* energy triggered burst capture.  keeps the last few seconds of raw
+ * IQ in memory and writes them, plus what follows, to a timestamped
+ * .cu8 file whenever a block crosses the power threshold.  a .txt
+ * file next to it records the capture of the burst's first sample.
+ * the history restarts after a gap or retune, so only the post window
+ * can be broken up and the .txt counts the gaps in it. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "block_pool.h"
+
+/* blocks that wait while a burst is written out, a longer write
+ * restarts the pre-trigger history */
+#define TRIGGER_QUEUE_DEPTH	16
+
+struct burst_trigger
+{
+	struct block_pool *pool;
+	int sub;
+	/* mean I^2+Q^2 per sample the threshold stands for */
+	uint32_t threshold;
+	uint32_t samp_rate;
+	struct block_sequence sequence;
+	/* rolling pre-trigger window, owned by the trigger thread */
+	uint8_t *ring;
+	size_t ring_len;
+	size_t ring_pos;
+	size_t ring_fill;
+	/* pre + post window handed to the writer thread */
+	uint8_t *burst;
+	size_t burst_len;
+	size_t burst_cap;
+	size_t post_len;
+	time_t burst_time;
+	struct block_meta burst_meta;
+	uint32_t burst_gaps;
+	int state;
+	uint32_t fired;
+	uint32_t missed;
+	int running;
+	pthread_t thread;
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+};
+
+/*!
+ * Subscribe a trigger to the pool and preallocate both windows,
+ * call before acquisition starts
+ *
+ * \param t the trigger to initialize
+ * \param pool the sample pool
+ * \param samp_rate in samples/second
+ * \param threshold_db mean power relative to full scale in dB
+ * \param pre_seconds history written out before the trigger
+ * \param post_seconds samples written out after the trigger
+ * \return 0 on success
+ */
+
+int trigger_init(struct burst_trigger *t, struct block_pool *pool, uint32_t samp_rate,
+	double threshold_db, double pre_seconds, double post_seconds);
+
+/*!
+ * Start the trigger and writer threads
+ *
+ * \param t the trigger given to trigger_init()
+ * \return 0 on success
+ */
+
+int trigger_start(struct burst_trigger *t);
+
+/*!
+ * Stop both threads and free the windows, a burst being written
+ * is finished first
+ *
+ * \param t the trigger given to trigger_init()
+ */
+
+void trigger_stop(struct burst_trigger *t);
+
+#endif
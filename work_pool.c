@@ -0,0 +1,177 @@
+/* work stealing thread pool */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "work_pool.h"
+
+struct worker_arg
+{
+	struct work_pool *pool;
+	int self;
+};
+
+static int deque_push(struct work_deque *d, struct work_item *item)
+{
+	int r = -1;
+	pthread_mutex_lock(&d->lock);
+	if (d->tail - d->head <= d->mask) {
+		d->items[d->tail & d->mask] = *item;
+		d->tail++;
+		r = 0;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return r;
+}
+
+static int deque_take(struct work_deque *d, struct work_item *item, int steal)
+/* the owner takes the oldest item, thieves the newest */
+{
+	int r = -1;
+	pthread_mutex_lock(&d->lock);
+	if (d->head != d->tail) {
+		if (steal) {
+			d->tail--;
+			*item = d->items[d->tail & d->mask];
+		} else {
+			*item = d->items[d->head & d->mask];
+			d->head++;
+		}
+		r = 0;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return r;
+}
+
+static int find_work(struct work_pool *pool, int self, struct work_item *item)
+{
+	int i, victim;
+	if (deque_take(&pool->deques[self], item, 0) == 0) {
+		return 0;}
+	for (i = 1; i < pool->threads; i++) {
+		victim = (self + i) % pool->threads;
+		if (deque_take(&pool->deques[victim], item, 1) == 0) {
+			__atomic_add_fetch(&pool->steals, 1, __ATOMIC_RELAXED);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static void *worker_loop(void *arg)
+{
+	struct worker_arg *w = (struct worker_arg*)arg;
+	struct work_pool *pool = w->pool;
+	int self = w->self;
+	struct work_item item;
+	free(w);
+	for (;;) {
+		if (find_work(pool, self, &item) == 0) {
+			__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+			item.fn(item.arg);
+			continue;
+		}
+		pthread_mutex_lock(&pool->idle_lock);
+		while (pool->running && __atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) == 0) {
+			pthread_cond_wait(&pool->idle, &pool->idle_lock);}
+		if (!pool->running && __atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) == 0) {
+			pthread_mutex_unlock(&pool->idle_lock);
+			break;
+		}
+		pthread_mutex_unlock(&pool->idle_lock);
+	}
+	return NULL;
+}
+
+int work_pool_init(struct work_pool *pool, int threads, uint32_t depth)
+{
+	int i;
+	uint32_t size = 1;
+	struct worker_arg *w;
+	memset(pool, 0, sizeof(struct work_pool));
+	if (threads <= 0) {
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);}
+	if (threads <= 0) {
+		threads = 1;}
+	while (size < depth) {
+		size <<= 1;}
+	pool->workers = (pthread_t*)calloc(threads, sizeof(pthread_t));
+	pool->deques = (struct work_deque*)calloc(threads, sizeof(struct work_deque));
+	if (!pool->workers || !pool->deques) {
+		free(pool->workers);
+		free(pool->deques);
+		return -1;
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_mutex_init(&pool->deques[i].lock, NULL);
+		pool->deques[i].items = (struct work_item*)calloc(size, sizeof(struct work_item));
+		pool->deques[i].mask = size - 1;
+		if (!pool->deques[i].items) {
+			return -1;}
+	}
+	pthread_mutex_init(&pool->idle_lock, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+	pool->running = 1;
+	/* workers read the count, so it is fixed before any of them start */
+	pool->threads = threads;
+	for (i = 0; i < threads; i++) {
+		w = (struct worker_arg*)malloc(sizeof(struct worker_arg));
+		w->pool = pool;
+		w->self = i;
+		if (pthread_create(&pool->workers[i], NULL, worker_loop, w) != 0) {
+			fprintf(stderr, "Failed to start worker thread %d.\n", i);
+			free(w);
+			pthread_mutex_lock(&pool->idle_lock);
+			pool->running = 0;
+			pthread_cond_broadcast(&pool->idle);
+			pthread_mutex_unlock(&pool->idle_lock);
+			while (i-- > 0) {
+				pthread_join(pool->workers[i], NULL);}
+			pool->threads = 0;
+			return -1;
+		}
+	}
+	fprintf(stderr, "Started %d worker threads.\n", pool->threads);
+	return 0;
+}
+
+int work_pool_submit(struct work_pool *pool, void (*fn)(void *arg), void *arg)
+{
+	struct work_item item;
+	uint32_t slot;
+	item.fn = fn;
+	item.arg = arg;
+	slot = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) % pool->threads;
+	/* count it before it is visible so a worker never sees pending go negative */
+	__atomic_add_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+	if (deque_push(&pool->deques[slot], &item) < 0) {
+		__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+		return -1;
+	}
+	pthread_mutex_lock(&pool->idle_lock);
+	pthread_cond_signal(&pool->idle);
+	pthread_mutex_unlock(&pool->idle_lock);
+	return 0;
+}
+
+void work_pool_free(struct work_pool *pool)
+{
+	int i;
+	pthread_mutex_lock(&pool->idle_lock);
+	pool->running = 0;
+	pthread_cond_broadcast(&pool->idle);
+	pthread_mutex_unlock(&pool->idle_lock);
+	for (i = 0; i < pool->threads; i++) {
+		pthread_join(pool->workers[i], NULL);}
+	for (i = 0; i < pool->threads; i++) {
+		free(pool->deques[i].items);
+		pthread_mutex_destroy(&pool->deques[i].lock);
+	}
+	free(pool->workers);
+	free(pool->deques);
+	memset(pool, 0, sizeof(struct work_pool));
+}
+
+// vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
@@ -0,0 +1,69 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+/* work stealing thread pool.  every worker owns a deque, work is
+ * spread over them round robin and a worker whose deque runs dry
+ * steals from the back of the others before going to sleep. */
+
+#include <stdint.h>
+#include <pthread.h>
+
+struct work_item
+{
+	void (*fn)(void *arg);
+	void *arg;
+};
+
+struct work_deque
+{
+	pthread_mutex_t lock;
+	struct work_item *items;
+	uint32_t mask;
+	uint32_t head;
+	uint32_t tail;
+} __attribute__((aligned(64)));
+
+struct work_pool
+{
+	int threads;
+	pthread_t *workers;
+	struct work_deque *deques;
+	uint32_t next;
+	int pending;
+	int running;
+	uint32_t steals;
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle;
+};
+
+/*!
+ * Start the workers
+ *
+ * \param pool the pool to initialize
+ * \param threads worker count, 0 or less means one per online core
+ * \param depth items each deque can hold
+ * \return 0 on success
+ */
+
+int work_pool_init(struct work_pool *pool, int threads, uint32_t depth);
+
+/*!
+ * Queue one item, any thread may submit
+ *
+ * \param pool the pool given to work_pool_init()
+ * \param fn called on a worker thread
+ * \param arg handed to fn
+ * \return 0 on success, -1 when the chosen deque is full
+ */
+
+int work_pool_submit(struct work_pool *pool, void (*fn)(void *arg), void *arg);
+
+/*!
+ * Run what is still queued, then stop and free the workers
+ *
+ * \param pool the pool given to work_pool_init()
+ */
+
+void work_pool_free(struct work_pool *pool);
+
+#endif